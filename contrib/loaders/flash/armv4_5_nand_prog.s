@@ -0,0 +1,76 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+	.text
+	.arm
+	.arch armv4
+
+	.section .init
+
+/* Programs consecutive pages of a large page, 8-bit wide NAND.
+ *
+ * Inputs:
+ *  r0	NAND data address (byte wide)
+ *  r1	buffer address, pages of data plus OOB back to back
+ *  r2	bytes per page, data plus OOB
+ *  r3	first page
+ *  r4	page count
+ *  r5	NAND command address
+ *  r6	NAND address address
+ *  r7	row address cycles
+ * Outputs:
+ *  r4	pages not programmed, zero on success
+ *  r8	last status read
+ */
+page:
+	mov	r8, #0x80		/* SEQIN */
+	strb	r8, [r5]
+	mov	r8, #0			/* column 0, two cycles */
+	strb	r8, [r6]
+	strb	r8, [r6]
+	mov	r9, r3
+	mov	r10, r7
+row:
+	strb	r9, [r6]
+	mov	r9, r9, lsr #8
+	subs	r10, r10, #1
+	bne	row
+
+	mov	r10, r2
+copy:
+	ldrb	r8, [r1], #1
+	strb	r8, [r0]
+	subs	r10, r10, #1
+	bne	copy
+
+	mov	r8, #0x10		/* PAGEPROG */
+	strb	r8, [r5]
+	mov	r8, #0x70		/* STATUS */
+	strb	r8, [r5]
+wait:
+	ldrb	r8, [r0]
+	tst	r8, #0x40		/* ready */
+	beq	wait
+	tst	r8, #1			/* fail */
+	bne	exit
+
+	add	r3, r3, #1
+	subs	r4, r4, #1
+	bne	page
+
+exit:
+	bkpt	#0
+
+	.end
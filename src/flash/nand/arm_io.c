@@ -297,3 +297,194 @@ int arm_nandread(struct arm_nand_data *nand, uint8_t *data, uint32_t size)
 
 	return retval;
 }
+
+/** Most pages the program area is sized for; fewer if memory is short. */
+#define ARM_NAND_PROG_PAGES	16
+
+/**
+ * ARM-specific programming of consecutive pages of a large page, 8-bit wide
+ * NAND.  Each batch of pages is downloaded once, then an on-chip loop issues
+ * SEQIN, the address cycles, the page data, PAGEPROG and the status poll for
+ * every page in the batch, so the host only pays one algorithm run per batch
+ * instead of a command, address and status round trip per page.
+ *
+ * For now this supports ARMv4 and ARMv5 cores; others return
+ * ERROR_NAND_NO_BUFFER so callers fall back to page by page writes.
+ *
+ * @param nand Pointer to the arm_nand_data struct that defines the I/O
+ * @param page First page to be programmed
+ * @param num_pages Number of consecutive pages to program
+ * @param row_cycles Number of row address cycles (2 or 3)
+ * @param data Page contents, each page immediately followed by its OOB bytes
+ * @param page_size Bytes written per page, data plus OOB
+ * @return Success or failure of the operation; ERROR_NAND_NO_BUFFER means
+ *         no page has been touched
+ */
+int arm_nand_write_pages(struct arm_nand_data *nand, uint32_t page,
+		unsigned num_pages, unsigned row_cycles,
+		const uint8_t *data, uint32_t page_size)
+{
+	struct target *target = nand->target;
+	struct arm_algorithm armv4_5_algo;
+	struct arm *arm = target->arch_info;
+	struct reg_param reg_params[9];
+	uint32_t target_buf;
+	uint32_t exit_var = 0;
+	int retval;
+
+	/* Inputs:
+	 *  r0	NAND data address (byte wide)
+	 *  r1	buffer address
+	 *  r2	bytes per page, data plus OOB
+	 *  r3	first page
+	 *  r4	page count
+	 *  r5	NAND command address
+	 *  r6	NAND address address
+	 *  r7	row address cycles
+	 * Outputs:
+	 *  r4	pages not programmed, zero on success
+	 *  r8	last status read
+	 *
+	 * see contrib/loaders/flash/armv4_5_nand_prog.s for src
+	 */
+	static const uint32_t code_armv4_5[] = {
+		0xe3a08080,	/* p: mov   r8, #0x80       */
+		0xe5c58000,	/*    strb  r8, [r5]        */
+		0xe3a08000,	/*    mov   r8, #0          */
+		0xe5c68000,	/*    strb  r8, [r6]        */
+		0xe5c68000,	/*    strb  r8, [r6]        */
+		0xe1a09003,	/*    mov   r9, r3          */
+		0xe1a0a007,	/*    mov   r10, r7         */
+		0xe5c69000,	/* a: strb  r9, [r6]        */
+		0xe1a09429,	/*    mov   r9, r9, lsr #8  */
+		0xe25aa001,	/*    subs  r10, r10, #1    */
+		0x1afffffb,	/*    bne   a               */
+		0xe1a0a002,	/*    mov   r10, r2         */
+		0xe4d18001,	/* d: ldrb  r8, [r1], #1    */
+		0xe5c08000,	/*    strb  r8, [r0]        */
+		0xe25aa001,	/*    subs  r10, r10, #1    */
+		0x1afffffb,	/*    bne   d               */
+		0xe3a08010,	/*    mov   r8, #0x10       */
+		0xe5c58000,	/*    strb  r8, [r5]        */
+		0xe3a08070,	/*    mov   r8, #0x70       */
+		0xe5c58000,	/*    strb  r8, [r5]        */
+		0xe5d08000,	/* w: ldrb  r8, [r0]        */
+		0xe3180040,	/*    tst   r8, #0x40       */
+		0x0afffffc,	/*    beq   w               */
+		0xe3180001,	/*    tst   r8, #1          */
+		0x1a000002,	/*    bne   e               */
+		0xe2833001,	/*    add   r3, r3, #1      */
+		0xe2544001,	/*    subs  r4, r4, #1      */
+		0x1affffe3,	/*    bne   p               */
+
+		/* exit: ARMv4 needs hardware breakpoint */
+		0xe1200070,	/* e: bkpt  #0              */
+	};
+	unsigned target_code_size = sizeof(code_armv4_5);
+
+	if (!nand->cmd || !nand->addr || is_armv7m(target_to_armv7m(target)))
+		return ERROR_NAND_NO_BUFFER;
+
+	/* REVISIT the area is sized for one page size; boards mixing
+	 * chips with different page sizes reallocate it on every switch.
+	 */
+	if (nand->prog_area && nand->prog_page_size != page_size) {
+		target_free_working_area(target, nand->prog_area);
+		nand->prog_area = NULL;
+	}
+
+	if (!nand->prog_area) {
+		unsigned pages;
+
+		for (pages = ARM_NAND_PROG_PAGES; pages > 0; pages /= 2) {
+			retval = arm_code_to_working_area(target, code_armv4_5,
+					target_code_size, pages * page_size,
+					&nand->prog_area);
+			if (retval != ERROR_NAND_NO_BUFFER)
+				break;
+		}
+		if (retval != ERROR_OK) {
+			if (nand->prog_area) {
+				target_free_working_area(target, nand->prog_area);
+				nand->prog_area = NULL;
+			}
+			return retval;
+		}
+
+		nand->prog_pages = pages;
+		nand->prog_page_size = page_size;
+		LOG_DEBUG("NAND page program area: %u pages of %u bytes",
+				pages, (unsigned) page_size);
+	}
+
+	armv4_5_algo.common_magic = ARM_COMMON_MAGIC;
+	armv4_5_algo.core_mode = ARM_MODE_SVC;
+	armv4_5_algo.core_state = ARM_STATE_ARM;
+
+	target_buf = nand->prog_area->address + target_code_size;
+
+	/* set up parameters */
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_OUT);
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);
+	init_reg_param(&reg_params[3], "r3", 32, PARAM_OUT);
+	init_reg_param(&reg_params[4], "r4", 32, PARAM_IN_OUT);
+	init_reg_param(&reg_params[5], "r5", 32, PARAM_OUT);
+	init_reg_param(&reg_params[6], "r6", 32, PARAM_OUT);
+	init_reg_param(&reg_params[7], "r7", 32, PARAM_OUT);
+	init_reg_param(&reg_params[8], "r8", 32, PARAM_IN);
+
+	buf_set_u32(reg_params[0].value, 0, 32, nand->data);
+	buf_set_u32(reg_params[1].value, 0, 32, target_buf);
+	buf_set_u32(reg_params[2].value, 0, 32, page_size);
+	buf_set_u32(reg_params[5].value, 0, 32, nand->cmd);
+	buf_set_u32(reg_params[6].value, 0, 32, nand->addr);
+	buf_set_u32(reg_params[7].value, 0, 32, row_cycles);
+
+	/* armv4 must exit using a hardware breakpoint */
+	if (arm->arch == ARM_ARCH_V4)
+		exit_var = nand->prog_area->address + target_code_size - 4;
+
+	retval = ERROR_OK;
+	while (num_pages > 0) {
+		unsigned count = MIN(num_pages, nand->prog_pages);
+		uint32_t remaining;
+
+		/* copy this batch to the work area */
+		retval = target_write_buffer(target, target_buf,
+				count * page_size, data);
+		if (retval != ERROR_OK)
+			break;
+
+		buf_set_u32(reg_params[3].value, 0, 32, page);
+		buf_set_u32(reg_params[4].value, 0, 32, count);
+
+		/* use alg to program the batch, one tPROG per page */
+		retval = target_run_algorithm(target, 0, NULL, 9, reg_params,
+				nand->prog_area->address, exit_var,
+				1000 + count * 10, &armv4_5_algo);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("error executing hosted NAND page program");
+			break;
+		}
+
+		remaining = buf_get_u32(reg_params[4].value, 0, 32);
+		if (remaining) {
+			LOG_ERROR("write operation didn't pass at page %" PRIu32
+					", status: 0x%2.2x",
+					page + count - remaining,
+					(unsigned) buf_get_u32(reg_params[8].value, 0, 8));
+			retval = ERROR_NAND_OPERATION_FAILED;
+			break;
+		}
+
+		page += count;
+		data += count * page_size;
+		num_pages -= count;
+	}
+
+	for (unsigned i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	return retval;
+}
@@ -46,10 +46,25 @@ struct arm_nand_data {
 	/** Last operation executed using this struct. */
 	enum arm_nand_op op;
 
+	/** Command and address latches, needed for page programming;
+	 * zero when the controller doesn't provide them. */
+	uint32_t cmd;
+	uint32_t addr;
+
+	/** The program area holds the page program loop and a page batch. */
+	struct working_area *prog_area;
+
+	/** Number of pages, and bytes per page, the program area holds. */
+	unsigned prog_pages;
+	unsigned prog_page_size;
+
 	/* currently implicit:  data width == 8 bits (not 16) */
 };
 
 int arm_nandwrite(struct arm_nand_data *nand, uint8_t *data, int size);
 int arm_nandread(struct arm_nand_data *nand, uint8_t *data, uint32_t size);
+int arm_nand_write_pages(struct arm_nand_data *nand, uint32_t page,
+		unsigned num_pages, unsigned row_cycles,
+		const uint8_t *data, uint32_t page_size);
 
 #endif /* OPENOCD_FLASH_NAND_ARM_IO_H */
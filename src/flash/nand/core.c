@@ -688,6 +688,49 @@ int nand_write_page(struct nand_device *nand, uint32_t page,
 		return nand->controller->write_page(nand, page, data, data_size, oob, oob_size);
 }
 
+int nand_write_pages(struct nand_device *nand, uint32_t page,
+	unsigned int num_pages, uint8_t *data,
+	uint32_t data_size, uint32_t oob_size)
+{
+	uint32_t stride = data_size + oob_size;
+	uint32_t pages_per_block;
+	int retval = ERROR_NAND_NO_BUFFER;
+
+	if (!nand->device)
+		return ERROR_NAND_DEVICE_NOT_PROBED;
+
+	if (!num_pages)
+		return ERROR_OK;
+
+	/* the controller may program a whole batch at once, but only
+	 * where nand_write_page() would have used the raw path anyway
+	 */
+	if (nand->controller->write_pages && data_size
+			&& (nand->use_raw || !nand->controller->write_page)
+			&& nand->page_size > 512 && nand->bus_width == 8) {
+		pages_per_block = nand->erase_size / nand->page_size;
+		for (uint32_t block = page / pages_per_block;
+				block <= (page + num_pages - 1) / pages_per_block; block++)
+			nand->blocks[block].is_erased = 0;
+
+		retval = nand->controller->write_pages(nand, page, num_pages,
+				data, data_size, oob_size);
+	}
+	if (retval != ERROR_NAND_NO_BUFFER)
+		return retval;
+
+	for (unsigned int i = 0; i < num_pages; i++) {
+		retval = nand_write_page(nand, page + i,
+				data_size ? data : NULL, data_size,
+				oob_size ? data + data_size : NULL, oob_size);
+		if (retval != ERROR_OK)
+			return retval;
+		data += stride;
+	}
+
+	return ERROR_OK;
+}
+
 int nand_read_page(struct nand_device *nand, uint32_t page,
 	uint8_t *data, uint32_t data_size,
 	uint8_t *oob, uint32_t oob_size)
@@ -71,6 +71,15 @@ struct nand_flash_controller {
 	int (*write_page)(struct nand_device *nand, uint32_t page, uint8_t *data,
 			  uint32_t data_size, uint8_t *oob, uint32_t oob_size);
 
+	/**
+	 * Program consecutive large pages of an 8-bit device without ECC,
+	 * each page's @a oob_size OOB bytes following its @a data_size
+	 * data bytes.  Returns ERROR_NAND_NO_BUFFER, having written nothing,
+	 * when the pages must instead be written one at a time.
+	 */
+	int (*write_pages)(struct nand_device *nand, uint32_t page, unsigned int num_pages,
+			   uint8_t *data, uint32_t data_size, uint32_t oob_size);
+
 	/** Read a page from the NAND device. */
 	int (*read_page)(struct nand_device *nand, uint32_t page, uint8_t *data, uint32_t data_size,
 			 uint8_t *oob, uint32_t oob_size);
@@ -3,8 +3,8 @@
  * and correction of 1-bit errors in a 256 byte block of data.
  *
  * [ Extracted from the initial code found in some early Linux versions.
- *   The current Linux code is bigger while being faster, but this is of
- *   no real benefit when the bottleneck largely remains the JTAG link.  ]
+ *   The ECC calculation has since been changed to fold the data a word
+ *   at a time, which matters when generating ECC for large images.    ]
  *
  * Copyright (C) 2000-2004 Steven J. Hill (sjhill at realitydiluted.com)
  *                         Toshiba America Electronics Components, Inc.
@@ -64,30 +64,52 @@ static const uint8_t nand_ecc_precalc_table[] = {
 	0x00, 0x55, 0x56, 0x03, 0x59, 0x0c, 0x0f, 0x5a, 0x5a, 0x0f, 0x0c, 0x59, 0x03, 0x56, 0x55, 0x00
 };
 
+static inline int parity_u64(uint64_t x)
+{
+	return parity_u32(x ^ (x >> 32));
+}
+
 /*
  * nand_calculate_ecc - Calculate 3-byte ECC for 256-byte block
+ *
+ * Both parities are linear in the data, so the block is folded 64 bits at
+ * a time: line parity bit k (k >= 3) is the parity of all words whose word
+ * index has bit k - 3 set, bits 0 to 2 come from the byte lanes of the XOR
+ * of all words, and the column parity is that of the XOR of all bytes.
  */
 int nand_calculate_ecc(struct nand_device *nand, const uint8_t *dat, uint8_t *ecc_code)
 {
-	uint8_t idx, reg1, reg2, reg3, tmp1, tmp2;
-	int i;
-
-	/* Initialize variables */
-	reg1 = reg2 = reg3 = 0;
-
-	/* Build up column parity */
-	for (i = 0; i < 256; i++) {
-		/* Get CP0 - CP5 from table */
-		idx = nand_ecc_precalc_table[*dat++];
-		reg1 ^= (idx & 0x3f);
-
-		/* All bit XOR = 1 ? */
-		if (idx & 0x40) {
-			reg3 ^= (uint8_t) i;
-			reg2 ^= ~((uint8_t) i);
-		}
+	uint8_t reg1, reg2, reg3, tmp1, tmp2;
+	uint64_t all = 0, line[5] = { 0 };
+	int i, k;
+
+	/* Pairs of words differing in bit 0 of their index are folded into
+	 * one first, halving the work for the remaining index bits */
+	for (i = 0; i < 32; i += 2) {
+		uint64_t even = le_to_h_u64(dat + 8 * i);
+		uint64_t odd = le_to_h_u64(dat + 8 * i + 8);
+		uint64_t pair = even ^ odd;
+
+		all ^= pair;
+		line[0] ^= odd;
+		for (k = 1; k < 5; k++)
+			line[k] ^= pair & -(uint64_t)((i >> k) & 1);
 	}
 
+	/* Line parity; reg2 is the parity over the inverted byte indices */
+	reg3 = parity_u64(all & 0xff00ff00ff00ff00ull) |
+		parity_u64(all & 0xffff0000ffff0000ull) << 1 |
+		parity_u64(all & 0xffffffff00000000ull) << 2;
+	for (k = 0; k < 5; k++)
+		reg3 |= parity_u64(line[k]) << (k + 3);
+	reg2 = parity_u64(all) ? ~reg3 : reg3;
+
+	/* Get CP0 - CP5 from table */
+	all ^= all >> 32;
+	all ^= all >> 16;
+	all ^= all >> 8;
+	reg1 = nand_ecc_precalc_table[all & 0xff] & 0x3f;
+
 	/* Create non-inverted ECC code from line parity */
 	tmp1  = (reg3 & 0x80) >> 0; /* B7 -> B7 */
 	tmp1 |= (reg2 & 0x80) >> 1; /* B7 -> B6 */
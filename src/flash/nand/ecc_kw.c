@@ -47,6 +47,20 @@ static uint16_t gf_exp[1023 + 1023];
  */
 static uint16_t gf_log[1024];
 
+/*
+ * Logs of the generator polynomial coefficients, highest order first.
+ */
+static const uint16_t rs_gen_log[8] = {
+	0x21c, 0x181, 0x18e, 0x25f, 0x197, 0x193, 0x237, 0x024,
+};
+
+/*
+ * rs_gen_mul[a][k] is a times generator coefficient k, so that a
+ * reduction step needs one row lookup instead of a log/exp pair per
+ * symbol. Row 0 is all zeros, which also saves the branch on a = 0.
+ */
+static uint16_t rs_gen_mul[1024][8];
+
 static void gf_build_log_exp_table(void)
 {
 	int i;
@@ -71,6 +85,10 @@ static void gf_build_log_exp_table(void)
 		if (p_i & (1 << 10))
 			p_i ^= MODPOLY;
 	}
+
+	for (i = 1; i < 1024; i++)
+		for (int k = 0; k < 8; k++)
+			rs_gen_mul[i][k] = gf_exp[gf_log[i] + rs_gen_log[k]];
 }
 
 
@@ -136,27 +154,16 @@ int nand_calculate_ecc_kw(struct nand_device *nand, const uint8_t *data, uint8_t
 		if (i >= 0)
 			d = data[i];
 
-		if (r7) {
-			uint16_t *t = gf_exp + gf_log[r7];
-
-			r7 = r6 ^ t[0x21c];
-			r6 = r5 ^ t[0x181];
-			r5 = r4 ^ t[0x18e];
-			r4 = r3 ^ t[0x25f];
-			r3 = r2 ^ t[0x197];
-			r2 = r1 ^ t[0x193];
-			r1 = r0 ^ t[0x237];
-			r0 = d  ^ t[0x024];
-		} else {
-			r7 = r6;
-			r6 = r5;
-			r5 = r4;
-			r4 = r3;
-			r3 = r2;
-			r2 = r1;
-			r1 = r0;
-			r0 = d;
-		}
+		const uint16_t *t = rs_gen_mul[r7];
+
+		r7 = r6 ^ t[0];
+		r6 = r5 ^ t[1];
+		r5 = r4 ^ t[2];
+		r4 = r3 ^ t[3];
+		r3 = r2 ^ t[4];
+		r2 = r1 ^ t[5];
+		r1 = r0 ^ t[6];
+		r0 = d  ^ t[7];
 	}
 
 	ecc[0] = r0;
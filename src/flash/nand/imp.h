@@ -27,6 +27,10 @@ int nand_write_page(struct nand_device *nand,
 		uint32_t page, uint8_t *data, uint32_t data_size,
 		uint8_t *oob, uint32_t oob_size);
 
+int nand_write_pages(struct nand_device *nand, uint32_t page,
+		unsigned int num_pages, uint8_t *data,
+		uint32_t data_size, uint32_t oob_size);
+
 int nand_read_page(struct nand_device *nand, uint32_t page,
 		uint8_t *data, uint32_t data_size,
 		uint8_t *oob, uint32_t oob_size);
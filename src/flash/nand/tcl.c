@@ -31,6 +31,9 @@
 /* to be removed */
 extern struct nand_device *nand_devices;
 
+/** Pages handed to nand_write_pages() at once by "nand write". */
+#define NAND_WRITE_BATCH_PAGES 16
+
 COMMAND_HANDLER(handle_nand_list_command)
 {
 	struct nand_device *p;
@@ -249,27 +252,54 @@ COMMAND_HANDLER(handle_nand_write_command)
 	if (retval != ERROR_OK)
 		return retval;
 
+	/* gather pages so the controller can program them as one batch;
+	 * OOB-only writes don't advance the address, so go one at a time
+	 */
+	uint32_t stride = s.page_size + s.oob_size;
+	unsigned int batch_pages = s.page ? NAND_WRITE_BATCH_PAGES : 1;
+	uint8_t *batch = malloc(batch_pages * stride);
+	if (!batch) {
+		LOG_ERROR("no memory for page buffer");
+		nand_fileio_cleanup(&s);
+		return ERROR_FAIL;
+	}
+
 	uint32_t total_bytes = s.size;
 	while (s.size > 0) {
-		int bytes_read = nand_fileio_read(nand, &s);
-		if (bytes_read <= 0) {
-			command_print(CMD, "error while reading file");
-			nand_fileio_cleanup(&s);
-			return ERROR_FAIL;
+		uint32_t batch_address = s.address;
+		unsigned int num_pages = 0;
+
+		while (s.size > 0 && num_pages < batch_pages) {
+			int bytes_read = nand_fileio_read(nand, &s);
+			if (bytes_read <= 0) {
+				command_print(CMD, "error while reading file");
+				free(batch);
+				nand_fileio_cleanup(&s);
+				return ERROR_FAIL;
+			}
+			s.size -= bytes_read;
+
+			uint8_t *p = batch + num_pages * stride;
+			if (s.page)
+				memcpy(p, s.page, s.page_size);
+			if (s.oob)
+				memcpy(p + s.page_size, s.oob, s.oob_size);
+			num_pages++;
+			s.address += s.page_size;
 		}
-		s.size -= bytes_read;
 
-		retval = nand_write_page(nand, s.address / nand->page_size,
-				s.page, s.page_size, s.oob, s.oob_size);
+		retval = nand_write_pages(nand, batch_address / nand->page_size,
+				num_pages, batch, s.page_size, s.oob_size);
 		if (retval != ERROR_OK) {
 			command_print(CMD, "failed writing file %s "
-				"to NAND flash %s at offset 0x%8.8" PRIx32,
-				CMD_ARGV[1], CMD_ARGV[0], s.address);
+				"to NAND flash %s in pages from offset 0x%8.8" PRIx32,
+				CMD_ARGV[1], CMD_ARGV[0], batch_address);
+			free(batch);
 			nand_fileio_cleanup(&s);
 			return retval;
 		}
-		s.address += s.page_size;
 	}
+	free(batch);
 
 	if (nand_fileio_finish(&s) == ERROR_OK) {
 		command_print(CMD, "wrote file %s to NAND flash %s up to "
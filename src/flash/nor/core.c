@@ -734,8 +734,194 @@ static bool flash_write_check_gap(struct flash_bank *bank,
 }
 
 
+/**
+ * A contiguous, padded and aligned piece of the image which falls into
+ * a single flash bank, ready to be erased, written and verified.
+ */
+struct flash_write_run {
+	struct flash_bank *bank;
+	target_addr_t address;
+	uint32_t size;
+	const uint8_t *data;	/* run contents, buffer or a slice of the image */
+	uint8_t *buffer;	/* padded copy, NULL when data points into the image */
+};
+
+/* Host memory the prepared runs may hold in padded copies before they are
+ * written out; runs used in place from the image don't count. */
+#define FLASH_WRITE_LOOKAHEAD_SIZE	(4 * 1024 * 1024)
+
+static int flash_write_range_unlock_verify(struct target *target, struct flash_bank *c,
+	const uint8_t *buffer, target_addr_t address, uint32_t size,
+	bool erase, bool unlock, bool write, bool verify)
+{
+	int retval = ERROR_OK;
+
+	if (unlock)
+		retval = flash_unlock_address_range(target, address, size);
+	if (retval == ERROR_OK) {
+		if (erase) {
+			/* calculate and erase sectors */
+			retval = flash_erase_address_range(target,
+					true, address, size);
+		}
+	}
+
+	if (retval == ERROR_OK) {
+		if (write) {
+			/* write flash sectors */
+			retval = flash_driver_write(c, buffer, address - c->base, size);
+		}
+	}
+
+	if (retval == ERROR_OK) {
+		if (verify) {
+			/* verify flash sectors */
+			retval = flash_driver_verify(c, buffer, address - c->base, size);
+		}
+	}
+
+	return retval;
+}
+
+/**
+ * Compare part of a bank against image data.  Banks read through
+ * default_flash_read() are memory mapped and compared by CRC on the
+ * target; other banks are read back through the driver.  Any error is
+ * reported as a difference, so the range just gets rewritten.
+ */
+static bool flash_range_differs(struct target *target, struct flash_bank *c,
+	uint32_t offset, uint32_t size, const uint8_t *data)
+{
+	int retval;
+
+	if (c->driver->read == default_flash_read) {
+		uint32_t image_crc, target_crc;
+
+		retval = image_calculate_checksum(data, size, &image_crc);
+		if (retval == ERROR_OK)
+			retval = target_checksum_memory(target, c->base + offset, size, &target_crc);
+		if (retval != ERROR_OK) {
+			LOG_DEBUG("checksum of bank %s offset 0x%8.8" PRIx32 " failed, rewriting",
+					c->name, offset);
+			return true;
+		}
+		return image_crc != target_crc;
+	}
+
+	uint8_t *buffer = malloc(size);
+	if (!buffer)
+		return true;
+
+	retval = flash_driver_read(c, buffer, offset, size);
+	bool differs = retval != ERROR_OK || memcmp(buffer, data, size) != 0;
+	free(buffer);
+
+	return differs;
+}
+
+/**
+ * Differential write of a run: compare each sector covered by the run
+ * against the target and only unlock/erase/write/verify the groups of
+ * consecutive sectors whose content differs.
+ */
+static int flash_write_run_diff(struct target *target, struct flash_write_run *run,
+	bool erase, bool unlock, bool verify, uint32_t *written)
+{
+	struct flash_bank *c = run->bank;
+	uint32_t run_start = run->address - c->base;
+	uint32_t run_end = run_start + run->size;
+	uint32_t diff_start = 0, diff_end = 0;
+	bool diff_pending = false;
+	uint32_t skipped = 0;
+	int retval;
+
+	*written = 0;
+
+	for (unsigned int sector = 0; sector <= c->num_sectors; sector++) {
+		bool differs = false;
+		uint32_t start = 0, end = 0;
+
+		if (sector < c->num_sectors) {
+			start = MAX(c->sectors[sector].offset, run_start);
+			end = MIN(c->sectors[sector].offset + c->sectors[sector].size, run_end);
+			if (start >= end)
+				continue;
+
+			differs = flash_range_differs(target, c, start, end - start,
+					run->data + start - run_start);
+			if (!differs)
+				skipped += end - start;
+		}
+
+		if (differs && diff_pending && diff_end == start) {
+			diff_end = end;
+			continue;
+		}
+
+		if (diff_pending) {
+			retval = flash_write_range_unlock_verify(target, c,
+					run->data + diff_start - run_start,
+					c->base + diff_start, diff_end - diff_start,
+					erase, unlock, true, verify);
+			if (retval != ERROR_OK)
+				return retval;
+			*written += diff_end - diff_start;
+			diff_pending = false;
+		}
+
+		if (differs) {
+			diff_start = start;
+			diff_end = end;
+			diff_pending = true;
+		}
+	}
+
+	if (skipped)
+		LOG_INFO("Skipped %" PRIu32 " bytes already matching the image in bank %s",
+				skipped, c->name);
+
+	return ERROR_OK;
+}
+
+static int flash_write_run_unlock_verify(struct target *target, struct flash_write_run *run,
+	bool erase, bool unlock, bool write, bool verify, bool diff_write, uint32_t *written)
+{
+	if (diff_write && write && run->bank->num_sectors)
+		return flash_write_run_diff(target, run, erase, unlock, verify, written);
+
+	*written = run->size;
+	return flash_write_range_unlock_verify(target, run->bank, run->data,
+			run->address, run->size, erase, unlock, write, verify);
+}
+
+/* Unlock, erase, write and verify the queued runs back to back and empty
+ * the queue */
+static int flash_write_runs(struct target *target, struct flash_write_run *runs,
+	unsigned int *num_runs, uint32_t *written, bool erase, bool unlock, bool write,
+	bool verify, bool diff_write)
+{
+	int retval = ERROR_OK;
+
+	for (unsigned int i = 0; i < *num_runs; i++) {
+		uint32_t run_written;
+
+		if (retval == ERROR_OK) {
+			retval = flash_write_run_unlock_verify(target, &runs[i], erase, unlock, write,
+					verify, diff_write, &run_written);
+			if (retval == ERROR_OK && written)
+				*written += run_written;	/* add run size to total written counter */
+		}
+
+		free(runs[i].buffer);
+		runs[i].buffer = NULL;
+	}
+	*num_runs = 0;
+
+	return retval;
+}
+
 int flash_write_unlock_verify(struct target *target, struct image *image,
-	uint32_t *written, bool erase, bool unlock, bool write, bool verify)
+	uint32_t *written, bool erase, bool unlock, bool write, bool verify, bool diff_write)
 {
 	int retval = ERROR_OK;
 
@@ -743,6 +929,9 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 	uint32_t section_offset;
 	struct flash_bank *c;
 	int *padding;
+	struct flash_write_run *runs = NULL;
+	unsigned int num_runs = 0;
+	size_t buffered = 0;
 
 	section = 0;
 	section_offset = 0;
@@ -901,99 +1090,111 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 			run_size += delta;
 		}
 
-		/* allocate buffer */
-		buffer = malloc(run_size);
-		if (!buffer) {
-			LOG_ERROR("Out of memory for flash bank buffer");
-			retval = ERROR_FAIL;
-			goto done;
-		}
-
-		if (padding_at_start)
-			memset(buffer, c->default_padded_value, padding_at_start);
-
-		buffer_idx = padding_at_start;
-
-		/* read sections to the buffer */
-		while (buffer_idx < run_size) {
-			size_t size_read;
-
-			size_read = run_size - buffer_idx;
-			if (size_read > sections[section]->size - section_offset)
-				size_read = sections[section]->size - section_offset;
-
-			/* KLUDGE!
-			 *
-			 * #¤%#"%¤% we have to figure out the section # from the sorted
-			 * list of pointers to sections to invoke image_read_section()...
-			 */
-			intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
-			int t_section_num = diff / sizeof(struct imagesection);
-
-			LOG_DEBUG("image_read_section: section = %d, t_section_num = %d, "
-					"section_offset = %"PRIu32", buffer_idx = %"PRIu32", size_read = %zu",
-				section, t_section_num, section_offset,
-				buffer_idx, size_read);
-			retval = image_read_section(image, t_section_num, section_offset,
-					size_read, buffer + buffer_idx, &size_read);
-			if (retval != ERROR_OK || size_read == 0) {
-				free(buffer);
-				goto done;
-			}
-
-			buffer_idx += size_read;
-			section_offset += size_read;
-
-			/* see if we need to pad the section */
-			if (padding[section]) {
-				memset(buffer + buffer_idx, c->default_padded_value, padding[section]);
-				buffer_idx += padding[section];
-			}
-
+		/* a run that is an unpadded slice of one section is used in place
+		 * when the image can map it, large binaries and ELFs are not copied */
+		const uint8_t *data = NULL;
+		buffer = NULL;
+		if (section_last == section && padding[section] == 0 && padding_at_start == 0 &&
+				image_map_section(image, sections[section] - image->sections,
+					section_offset, run_size, &data) == ERROR_OK) {
+			section_offset += run_size;
 			if (section_offset >= sections[section]->size) {
 				section++;
 				section_offset = 0;
 			}
-		}
+		} else {
+			/* allocate buffer */
+			buffer = malloc(run_size);
+			if (!buffer) {
+				LOG_ERROR("Out of memory for flash bank buffer");
+				retval = ERROR_FAIL;
+				goto done;
+			}
 
-		retval = ERROR_OK;
+			if (padding_at_start)
+				memset(buffer, c->default_padded_value, padding_at_start);
+
+			buffer_idx = padding_at_start;
+
+			/* read sections to the buffer */
+			while (buffer_idx < run_size) {
+				size_t size_read;
+
+				size_read = run_size - buffer_idx;
+				if (size_read > sections[section]->size - section_offset)
+					size_read = sections[section]->size - section_offset;
+
+				/* KLUDGE!
+				 *
+				 * #¤%#"%¤% we have to figure out the section # from the sorted
+				 * list of pointers to sections to invoke image_read_section()...
+				 */
+				intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
+				int t_section_num = diff / sizeof(struct imagesection);
+
+				LOG_DEBUG("image_read_section: section = %d, t_section_num = %d, "
+						"section_offset = %"PRIu32", buffer_idx = %"PRIu32", size_read = %zu",
+					section, t_section_num, section_offset,
+					buffer_idx, size_read);
+				retval = image_read_section(image, t_section_num, section_offset,
+						size_read, buffer + buffer_idx, &size_read);
+				if (retval != ERROR_OK || size_read == 0) {
+					free(buffer);
+					goto done;
+				}
 
-		if (unlock)
-			retval = flash_unlock_address_range(target, run_address, run_size);
-		if (retval == ERROR_OK) {
-			if (erase) {
-				/* calculate and erase sectors */
-				retval = flash_erase_address_range(target,
-						true, run_address, run_size);
-			}
-		}
+				buffer_idx += size_read;
+				section_offset += size_read;
 
-		if (retval == ERROR_OK) {
-			if (write) {
-				/* write flash sectors */
-				retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
-			}
-		}
+				/* see if we need to pad the section */
+				if (padding[section]) {
+					memset(buffer + buffer_idx, c->default_padded_value, padding[section]);
+					buffer_idx += padding[section];
+				}
 
-		if (retval == ERROR_OK) {
-			if (verify) {
-				/* verify flash sectors */
-				retval = flash_driver_verify(c, buffer, run_address - c->base, run_size);
+				if (section_offset >= sections[section]->size) {
+					section++;
+					section_offset = 0;
+				}
 			}
+			data = buffer;
 		}
 
-		free(buffer);
-
-		if (retval != ERROR_OK) {
-			/* abort operation */
+		/* queue the prepared run, target operations start once the whole
+		 * image has been read and padded or the lookahead is full */
+		struct flash_write_run *new_runs = realloc(runs, (num_runs + 1) * sizeof(*runs));
+		if (!new_runs) {
+			LOG_ERROR("Out of memory for flash write runs");
+			free(buffer);
+			retval = ERROR_FAIL;
 			goto done;
 		}
-
-		if (written)
-			*written += run_size;	/* add run size to total written counter */
+		runs = new_runs;
+		runs[num_runs].bank = c;
+		runs[num_runs].address = run_address;
+		runs[num_runs].size = run_size;
+		runs[num_runs].data = data;
+		runs[num_runs].buffer = buffer;
+		num_runs++;
+
+		if (buffer)
+			buffered += run_size;
+		if (buffered >= FLASH_WRITE_LOOKAHEAD_SIZE) {
+			retval = flash_write_runs(target, runs, &num_runs, written,
+					erase, unlock, write, verify, diff_write);
+			if (retval != ERROR_OK)
+				goto done;
+			buffered = 0;
+		}
 	}
 
+	retval = flash_write_runs(target, runs, &num_runs, written,
+			erase, unlock, write, verify, diff_write);
+
 done:
+	for (unsigned int i = 0; i < num_runs; i++)
+		free(runs[i].buffer);
+	free(runs);
 	free(sections);
 	free(padding);
 
@@ -1003,7 +1204,7 @@ done:
 int flash_write(struct target *target, struct image *image,
 	uint32_t *written, bool erase)
 {
-	return flash_write_unlock_verify(target, image, written, erase, false, true, false);
+	return flash_write_unlock_verify(target, image, written, erase, false, true, false, false);
 }
 
 struct flash_sector *alloc_block_array(uint32_t offset, uint32_t size,
@@ -37,6 +37,7 @@
 
 #include "imp.h"
 #include <helper/binarybuffer.h>
+#include <helper/time_support.h>
 #include <target/algorithm.h>
 #include <target/armv7m.h>
 #include <target/cortex_m.h>
@@ -110,6 +111,8 @@
 #define ISPCMD_READ_DID       0x0C
 #define ISPCMD_READ_UID       0x04
 #define ISPCMD_VECMAP         0x2E
+#define ISPCMD_READ_CKS       0x0D   /* M480 "Read Checksum" */
+#define ISPCMD_RUN_CKS        0x2D   /* M480 "Run Checksum Calculation" */
 #define ISPTRG_ISPGO          (1 << 0)
 
 /* access unlock keys */
@@ -120,6 +123,7 @@
 
 /* flash pagesizes */
 #define NUMICRO_PAGESIZE        512
+#define NUMICRO_M480_PAGESIZE   4096	/* also the checksum engine granularity */
 #define NUMICRO_DFMC_PAGESIZE   256
 
 /* flash MAX banks */
@@ -1070,6 +1074,7 @@ uint32_t m_M23SecureDebugState = NUMICRO_M23_SECURE_DEBUG_NORMAL;
 uint32_t m_flashInfo = 0; /* bit 0:SPROM exists; */
 char *m_target_name = "";
 bool m_bSPIMFlashSectorErased = 0;
+bool m_bChecksumMismatch = 0; /* FMC checksum disagreed with a good read back */
 
 /* Private methods */
 static int numicro_get_arm_arch(struct target *target)
@@ -1872,6 +1877,92 @@ static int numicro_init_isp(struct target *target)
 	return ERROR_OK;
 }
 
+/* Program LongWord Block Write through the async flash algorithm FIFO,
+ * so the USB transfer of the next chunk overlaps FMC programming */
+static int numicro_writeblock_async(struct flash_bank *bank, const uint8_t *buffer,
+		uint32_t offset, uint32_t count)
+{
+	struct target *target = bank->target;
+	uint32_t buffer_size;
+	struct working_area *write_algorithm;
+	struct working_area *source;
+	struct armv7m_algorithm armv7m_info;
+	uint32_t address = bank->base + offset;
+	int retval;
+
+	static const uint8_t numicro_fifo_write_code[] = {
+#include "../../../contrib/loaders/flash/numicro/numicro_m4.inc"
+	};
+
+	/* flash write code */
+	if (target_alloc_working_area(target, sizeof(numicro_fifo_write_code),
+			&write_algorithm) != ERROR_OK) {
+		LOG_WARNING("no working area available, can't do block memory writes");
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	retval = target_write_buffer(target, write_algorithm->address,
+			sizeof(numicro_fifo_write_code), numicro_fifo_write_code);
+	if (retval != ERROR_OK) {
+		target_free_working_area(target, write_algorithm);
+		return retval;
+	}
+
+	/* memory buffer, the FIFO takes all remaining working area
+	 * but never less than 256 bytes (two rp/wp words + data); the
+	 * FIFO always keeps one word free, so size it one word larger
+	 * than the data or a single word write could never be queued */
+	buffer_size = target_get_working_area_avail(target);
+	buffer_size = MIN(count * 4 + 8 + 4, MAX(buffer_size, 256));
+	buffer_size &= ~3UL;
+
+	retval = target_alloc_working_area(target, buffer_size, &source);
+	if (retval != ERROR_OK) {
+		target_free_working_area(target, write_algorithm);
+		LOG_WARNING("no large enough working area available, can't do block memory writes");
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	struct reg_param reg_params[5];
+
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);	/* FMC base (in), ISPCTL (out) */
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);	/* count (32-bit words) */
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);	/* buffer start */
+	init_reg_param(&reg_params[3], "r3", 32, PARAM_OUT);	/* buffer end */
+	init_reg_param(&reg_params[4], "r4", 32, PARAM_IN_OUT);	/* target address */
+
+	buf_set_u32(reg_params[0].value, 0, 32, NUMICRO_FLASH_BASE - m_addressMinusOffset);
+	buf_set_u32(reg_params[1].value, 0, 32, count);
+	buf_set_u32(reg_params[2].value, 0, 32, source->address);
+	buf_set_u32(reg_params[3].value, 0, 32, source->address + source->size);
+	buf_set_u32(reg_params[4].value, 0, 32, address);
+
+	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
+	armv7m_info.core_mode = ARM_MODE_THREAD;
+
+	retval = target_run_flash_async_algorithm(target, buffer, count, 4,
+			0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			source->address, source->size,
+			write_algorithm->address, 0,
+			&armv7m_info);
+
+	if (retval == ERROR_FLASH_OPERATION_FAILED) {
+		/* loader stops on ISPFF, numicro_write() clears it */
+		LOG_ERROR("flash write failed just before address 0x%" PRIx32 ", ISPCON 0x%" PRIx32,
+				buf_get_u32(reg_params[4].value, 0, 32),
+				buf_get_u32(reg_params[0].value, 0, 32));
+	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	target_free_working_area(target, source);
+	target_free_working_area(target, write_algorithm);
+
+	return retval;
+}
+
 /* Program LongWord Block Write */
 static int numicro_writeblock(struct flash_bank *bank, const uint8_t *buffer,
 		uint32_t offset, uint32_t count)
@@ -1910,6 +2001,15 @@ static int numicro_writeblock(struct flash_bank *bank, const uint8_t *buffer,
 		return ERROR_FLASH_DST_BREAKS_ALIGNMENT;
 	}
 
+	/* M480 FMC banks: stream words through the async FIFO loader,
+	 * fall back to the double-buffered algorithm if it does not fit */
+	if (strcmp(m_target_name, "M480") == 0 && !bSPIMFlashWrite) {
+		retval = numicro_writeblock_async(bank, buffer, offset, count);
+		if (retval != ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
+			return retval;
+		LOG_DEBUG("async flash write not possible, using double-buffered algorithm");
+	}
+
 	/* Difference between M0 and M4(M23) */
 	if (armv7m->arm.arch == ARM_ARCH_V6M) {
 		/* allocate working area with flash programming code */
@@ -3555,6 +3655,14 @@ static int numicro_write(struct flash_bank *bank, const uint8_t *buffer,
 	/* try using a block write */
 	retval = numicro_writeblock(bank, buffer, offset, words_remaining);
 
+	if (retval == ERROR_FLASH_OPERATION_FAILED) {
+		/* clear ISPFF so the next ISP command can run, keep the error */
+		if (target_read_u32(target, NUMICRO_FLASH_ISPCON - m_addressMinusOffset, &status) == ERROR_OK &&
+			(status & ISPCON_ISPFF))
+			target_write_u32(target, NUMICRO_FLASH_ISPCON - m_addressMinusOffset, status | ISPCON_ISPFF);
+		return retval;
+	}
+
 	if ((retval == ERROR_TARGET_RESOURCE_NOT_AVAILABLE) &&
 		(m_M23SecureDebugState != NUMICRO_M23_SECURE_DEBUG_NS)) {
 		/* if block write failed (no sufficient working area),
@@ -3684,6 +3792,147 @@ static int numicro_write(struct flash_bank *bank, const uint8_t *buffer,
 	return ERROR_OK;
 }
 
+/* Host side CRC-32 (IEEE 802.3, reflected, seed and result inverted,
+ * check value 0xCBF43926 for "123456789").  This is the variant Nuvoton's
+ * M480 BSP FMC_CRC32 sample checks FMC_GetChkSum() against, using the CRC
+ * controller in CRC-32 mode with reversed data and checksum, seed
+ * 0xFFFFFFFF and complemented result.  It has not been confirmed on
+ * hardware here, so numicro_verify() double checks any mismatch by
+ * read back and stops using the engine if the data turns out fine. */
+static uint32_t numicro_crc32(uint32_t crc, const uint8_t *buffer, uint32_t count)
+{
+	static const uint32_t crc32_nibble[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+		0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+		0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+	};
+
+	crc = ~crc;
+	while (count--) {
+		crc ^= *buffer++;
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+		crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+	}
+	return ~crc;
+}
+
+/* Let the M480 FMC checksum a 4 KiB aligned flash range in place and
+ * return the result, only the 32-bit checksum crosses the debug link */
+static int numicro_fmc_checksum(struct target *target, uint32_t address,
+		uint32_t count, uint32_t *checksum)
+{
+	uint32_t status;
+	int retval;
+
+	if ((address | count) & (NUMICRO_M480_PAGESIZE - 1) || count == 0)
+		return ERROR_FLASH_DST_BREAKS_ALIGNMENT;
+
+	retval = target_write_u32(target, NUMICRO_FLASH_ISPCMD - m_addressMinusOffset, ISPCMD_RUN_CKS);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = target_write_u32(target, NUMICRO_FLASH_ISPADR - m_addressMinusOffset, address);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = target_write_u32(target, NUMICRO_FLASH_ISPDAT - m_addressMinusOffset, count);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = target_write_u32(target, NUMICRO_FLASH_ISPTRG - m_addressMinusOffset, ISPTRG_ISPGO);
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* the engine reads the array at flash speed, allow 1 ms per KiB */
+	int64_t timeout = timeval_ms() + 100 + count / 1024;
+	for (;;) {
+		retval = target_read_u32(target, NUMICRO_FLASH_ISPTRG - m_addressMinusOffset, &status);
+		if (retval != ERROR_OK)
+			return retval;
+		if ((status & ISPTRG_ISPGO) == 0)
+			break;
+		if (timeval_ms() > timeout) {
+			LOG_ERROR("timed out waiting for flash checksum");
+			return ERROR_FLASH_OPERATION_FAILED;
+		}
+		keep_alive();
+	}
+
+	retval = target_read_u32(target, NUMICRO_FLASH_ISPCON - m_addressMinusOffset, &status);
+	if (retval != ERROR_OK)
+		return retval;
+	if (status & ISPCON_ISPFF) {
+		LOG_ERROR("flash checksum of 0x%08" PRIx32 " failed (ISPFF)", address);
+		/* write one to clear */
+		target_write_u32(target, NUMICRO_FLASH_ISPCON - m_addressMinusOffset, status);
+		return ERROR_FLASH_OPERATION_FAILED;
+	}
+
+	return numicro_fmc_cmd(target, ISPCMD_READ_CKS, address, count, checksum);
+}
+
+static int numicro_verify(struct flash_bank *bank, const uint8_t *buffer,
+		uint32_t offset, uint32_t count)
+{
+	struct target *target = bank->target;
+	uint32_t address = bank->base + offset;
+	uint32_t head, body, checksum;
+	int retval;
+
+	numicro_get_arm_arch(target);
+
+	/* only the M480 FMC has the checksum engine, SPIM flash is not behind it */
+	if (strcmp(m_target_name, "M480") != 0 ||
+		address >= NUMICRO_SPIM_FLASH_START_ADDRESS ||
+		target->state != TARGET_HALTED || m_bChecksumMismatch)
+		return default_flash_verify(bank, buffer, offset, count);
+
+	head = (NUMICRO_M480_PAGESIZE - (address & (NUMICRO_M480_PAGESIZE - 1))) & (NUMICRO_M480_PAGESIZE - 1);
+	if (head > count)
+		head = count;
+	body = (count - head) & ~(NUMICRO_M480_PAGESIZE - 1);
+	if (body == 0)
+		return default_flash_verify(bank, buffer, offset, count);
+
+	retval = numicro_init_isp(target);
+	if (retval == ERROR_OK)
+		retval = numicro_fmc_checksum(target, address + head, body, &checksum);
+	if (retval != ERROR_OK) {
+		LOG_WARNING("numicro: flash checksum unavailable, verifying by read back");
+		return default_flash_verify(bank, buffer, offset, count);
+	}
+
+	uint32_t image_crc = numicro_crc32(0, buffer + head, body);
+	LOG_DEBUG("addr 0x%08" PRIx32 ", len 0x%08" PRIx32 ", crc 0x%08" PRIx32 " 0x%08" PRIx32,
+		address + head, body, image_crc, checksum);
+	if (checksum != image_crc) {
+		LOG_WARNING("numicro: flash checksum 0x%08" PRIx32 " of 0x%08" PRIx32
+			"..0x%08" PRIx32 " differs from image CRC 0x%08" PRIx32 ", verifying by read back",
+			checksum, address + head, address + head + body - 1, image_crc);
+		retval = default_flash_verify(bank, buffer, offset, count);
+		if (retval == ERROR_OK) {
+			/* the data is fine, the CRC model is what's wrong */
+			LOG_WARNING("numicro: flash checksum doesn't match the host CRC model, "
+				"verifying by read back from now on");
+			m_bChecksumMismatch = 1;
+		}
+		return retval;
+	}
+
+	/* unaligned edges go through the generic path */
+	if (head) {
+		retval = default_flash_verify(bank, buffer, offset, head);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	uint32_t tail = count - head - body;
+	if (tail)
+		return default_flash_verify(bank, buffer + head + body, offset + head + body, tail);
+
+	return ERROR_OK;
+}
+
 static int numicro_get_cpu_type(struct target *target, const struct numicro_cpu_type **cpu)
 {
 	uint32_t part_id = 0xABCDEF12;
@@ -4166,6 +4415,43 @@ COMMAND_HANDLER(numicro_handle_NUC505_chip_reset_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(numicro_handle_checksum_command)
+{
+	uint32_t address, length, checksum;
+	int retval;
+
+	if (CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], length);
+
+	struct target *target = get_current_target(CMD_CTX);
+
+	numicro_get_arm_arch(target);
+	if (strcmp(m_target_name, "M480") != 0) {
+		command_print(CMD, "numicro checksum needs an M480 flash controller");
+		return ERROR_FAIL;
+	}
+
+	if ((address | length) & (NUMICRO_M480_PAGESIZE - 1) || length == 0) {
+		command_print(CMD, "address and length must be multiples of 0x%x", NUMICRO_M480_PAGESIZE);
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	retval = numicro_init_isp(target);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = numicro_fmc_checksum(target, address, length, &checksum);
+	if (retval != ERROR_OK)
+		return retval;
+
+	command_print(CMD, "0x%08" PRIx32, checksum);
+
+	return ERROR_OK;
+}
+
 static const struct command_registration numicro_exec_command_handlers[] = {
 	{
 		.name = "read_isp",
@@ -4216,6 +4502,13 @@ static const struct command_registration numicro_exec_command_handlers[] = {
 		.mode = COMMAND_EXEC,
 		.help = "NUC505 chip reset command.",
 	},
+	{
+		.name = "checksum",
+		.handler = numicro_handle_checksum_command,
+		.usage = "address length",
+		.mode = COMMAND_EXEC,
+		.help = "CRC-32 of a flash range computed by the M480 FMC.",
+	},
 
 	COMMAND_REGISTRATION_DONE
 };
@@ -4238,6 +4531,7 @@ const struct flash_driver numicro_flash = {
 	.erase = numicro_erase,
 	.write = numicro_write,
 	.read = default_flash_read,
+	.verify = numicro_verify,
 	.probe = numicro_probe,
 	.auto_probe = numicro_auto_probe,
 	.erase_check = default_flash_blank_check,
@@ -31,16 +31,51 @@
 #include "fileio.h"
 #include "replacements.h"
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 struct fileio {
 	char *url;
 	size_t size;
 	enum fileio_type type;
 	enum fileio_access access;
 	FILE *file;
+	const uint8_t *map;	/* read only mapping of the whole file, or NULL */
 };
 
+/* Map binary files opened for reading, so image sections can be handed
+ * out without copying. Anything that can't be mapped (pipes, empty files,
+ * hosts without mmap) keeps using stdio only. */
+static void fileio_map_local(struct fileio *fileio)
+{
+	fileio->map = NULL;
+#if defined(HAVE_SYS_MMAN_H) && !defined(_WIN32)
+	if (fileio->access != FILEIO_READ || fileio->type != FILEIO_BINARY || fileio->size == 0)
+		return;
+
+	void *map = mmap(NULL, fileio->size, PROT_READ, MAP_PRIVATE, fileno(fileio->file), 0);
+	if (map == MAP_FAILED) {
+		LOG_DEBUG("couldn't map %s: %s", fileio->url, strerror(errno));
+		return;
+	}
+	fileio->map = map;
+#endif
+}
+
+static void fileio_unmap_local(struct fileio *fileio)
+{
+#if defined(HAVE_SYS_MMAN_H) && !defined(_WIN32)
+	if (fileio->map)
+		munmap((void *)fileio->map, fileio->size);
+#endif
+	fileio->map = NULL;
+}
+
 static inline int fileio_close_local(struct fileio *fileio)
 {
+	fileio_unmap_local(fileio);
+
 	int retval = fclose(fileio->file);
 	if (retval != 0) {
 		if (retval == EBADF)
@@ -114,6 +149,8 @@ static inline int fileio_open_local(struct fileio *fileio)
 
 	fileio->size = file_size;
 
+	fileio_map_local(fileio);
+
 	return ERROR_OK;
 }
 
@@ -273,3 +310,24 @@ int fileio_size(struct fileio *fileio, size_t *size)
 
 	return ERROR_OK;
 }
+
+/**
+ * Get a pointer to @a size bytes of the file at @a position without
+ * copying them. The data stays valid until the file is closed.
+ *
+ * @returns ERROR_FILEIO_OPERATION_NOT_SUPPORTED if the file is not mapped,
+ * the caller then falls back to fileio_read().
+ */
+int fileio_map(struct fileio *fileio, size_t position, size_t size,
+		const uint8_t **data)
+{
+	if (!fileio->map)
+		return ERROR_FILEIO_OPERATION_NOT_SUPPORTED;
+
+	if (position > fileio->size || size > fileio->size - position)
+		return ERROR_FILEIO_OPERATION_FAILED;
+
+	*data = fileio->map + position;
+
+	return ERROR_OK;
+}
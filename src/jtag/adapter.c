@@ -121,6 +121,8 @@ int adapter_quit(void)
 			LOG_ERROR("failed: %d", result);
 	}
 
+	jtag_command_queue_free();
+
 	free(adapter_config.serial);
 	free(adapter_config.usb_location);
 
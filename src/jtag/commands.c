@@ -38,12 +38,25 @@ struct cmd_queue_page {
 	struct cmd_queue_page *next;
 	void *address;
 	size_t used;
+	size_t size;
 };
 
 #define CMD_QUEUE_PAGE_SIZE (1024 * 1024)
 static struct cmd_queue_page *cmd_queue_pages;
 static struct cmd_queue_page *cmd_queue_pages_tail;
 
+/* Pages released by a queue reset are kept for the next queue instead of
+ * going back to malloc. Every CMD_QUEUE_TRIM_INTERVAL resets the pool is
+ * trimmed to the most pages any queue needed during that interval. */
+#define CMD_QUEUE_TRIM_INTERVAL 256
+static struct cmd_queue_page *cmd_queue_free_pages;
+static unsigned int cmd_queue_pages_in_use;
+static unsigned int cmd_queue_pages_free;
+static unsigned int cmd_queue_pages_hwm;
+static unsigned int cmd_queue_resets_since_trim;
+
+static struct cmd_queue_stats cmd_queue_stats;
+
 struct jtag_command *jtag_command_queue;
 static struct jtag_command **next_command_pointer = &jtag_command_queue;
 
@@ -114,50 +127,125 @@ void *cmd_queue_alloc(size_t size)
 
 	if (*p_page) {
 		p_page = &cmd_queue_pages_tail;
-		if (CMD_QUEUE_PAGE_SIZE - (*p_page)->used < size)
+		if ((*p_page)->size - (*p_page)->used < size)
 			p_page = &((*p_page)->next);
 	}
 
 	if (!*p_page) {
-		*p_page = malloc(sizeof(struct cmd_queue_page));
+		if (size <= CMD_QUEUE_PAGE_SIZE && cmd_queue_free_pages) {
+			*p_page = cmd_queue_free_pages;
+			cmd_queue_free_pages = (*p_page)->next;
+			cmd_queue_pages_free--;
+			cmd_queue_stats.pages_reused++;
+		} else {
+			struct cmd_queue_page *page = malloc(sizeof(struct cmd_queue_page));
+			if (!page) {
+				LOG_ERROR("Out of memory for the command queue");
+				return NULL;
+			}
+			page->size = (size < CMD_QUEUE_PAGE_SIZE) ?
+						CMD_QUEUE_PAGE_SIZE : size;
+			page->address = malloc(page->size);
+			if (!page->address) {
+				LOG_ERROR("Out of memory for the command queue");
+				free(page);
+				return NULL;
+			}
+			*p_page = page;
+			cmd_queue_stats.pages_allocated++;
+		}
 		(*p_page)->used = 0;
-		size_t alloc_size = (size < CMD_QUEUE_PAGE_SIZE) ?
-					CMD_QUEUE_PAGE_SIZE : size;
-		(*p_page)->address = malloc(alloc_size);
 		(*p_page)->next = NULL;
 		cmd_queue_pages_tail = *p_page;
+		cmd_queue_pages_in_use++;
 	}
 
 	offset = (*p_page)->used;
 	(*p_page)->used += size;
+	cmd_queue_stats.bytes_queued += size;
 
 	t = (*p_page)->address;
 	return t + offset;
 }
 
+static void cmd_queue_page_free(struct cmd_queue_page *page)
+{
+	free(page->address);
+	free(page);
+	cmd_queue_stats.pages_freed++;
+}
+
+/* Move the queue's pages to the free pool, oversized ones are released */
 static void cmd_queue_free(void)
 {
 	struct cmd_queue_page *page = cmd_queue_pages;
 
+	if (cmd_queue_pages_in_use > cmd_queue_pages_hwm)
+		cmd_queue_pages_hwm = cmd_queue_pages_in_use;
+
 	while (page) {
-		struct cmd_queue_page *last = page;
-		free(page->address);
-		page = page->next;
-		free(last);
+		struct cmd_queue_page *next = page->next;
+		if (page->size == CMD_QUEUE_PAGE_SIZE) {
+			page->next = cmd_queue_free_pages;
+			cmd_queue_free_pages = page;
+			cmd_queue_pages_free++;
+		} else {
+			cmd_queue_page_free(page);
+		}
+		page = next;
 	}
 
 	cmd_queue_pages = NULL;
 	cmd_queue_pages_tail = NULL;
+	cmd_queue_pages_in_use = 0;
+
+	if (++cmd_queue_resets_since_trim >= CMD_QUEUE_TRIM_INTERVAL) {
+		while (cmd_queue_pages_free > cmd_queue_pages_hwm) {
+			page = cmd_queue_free_pages;
+			cmd_queue_free_pages = page->next;
+			cmd_queue_pages_free--;
+			cmd_queue_page_free(page);
+		}
+		cmd_queue_pages_hwm = 0;
+		cmd_queue_resets_since_trim = 0;
+	}
 }
 
 void jtag_command_queue_reset(void)
 {
 	cmd_queue_free();
+	cmd_queue_stats.flushes++;
 
 	jtag_command_queue = NULL;
 	next_command_pointer = &jtag_command_queue;
 }
 
+void jtag_command_queue_free(void)
+{
+	jtag_command_queue_reset();
+
+	while (cmd_queue_free_pages) {
+		struct cmd_queue_page *page = cmd_queue_free_pages;
+		cmd_queue_free_pages = page->next;
+		cmd_queue_page_free(page);
+	}
+	cmd_queue_pages_free = 0;
+	cmd_queue_pages_hwm = 0;
+	cmd_queue_resets_since_trim = 0;
+}
+
+void cmd_queue_get_stats(struct cmd_queue_stats *stats)
+{
+	*stats = cmd_queue_stats;
+	stats->pages_in_use = cmd_queue_pages_in_use;
+	stats->pages_free = cmd_queue_pages_free;
+}
+
+void cmd_queue_reset_stats(void)
+{
+	memset(&cmd_queue_stats, 0, sizeof(cmd_queue_stats));
+}
+
 /**
  * Copy a struct scan_field for insertion into the queue.
  *
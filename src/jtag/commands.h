@@ -165,8 +165,24 @@ extern struct jtag_command *jtag_command_queue;
 
 void *cmd_queue_alloc(size_t size);
 
+/** Counters of the command queue page allocator. */
+struct cmd_queue_stats {
+	uint64_t bytes_queued;		/**< bytes handed out by cmd_queue_alloc() */
+	uint64_t flushes;		/**< queue resets, one per flush */
+	uint64_t pages_allocated;	/**< pages taken from malloc() */
+	uint64_t pages_reused;		/**< pages taken from the free pool */
+	uint64_t pages_freed;		/**< pages given back by trimming */
+	unsigned int pages_in_use;	/**< pages holding the current queue */
+	unsigned int pages_free;	/**< pages kept in the free pool */
+};
+
+void cmd_queue_get_stats(struct cmd_queue_stats *stats);
+void cmd_queue_reset_stats(void);
+
 void jtag_queue_command(struct jtag_command *cmd);
 void jtag_command_queue_reset(void);
+/** Reset the queue and give its pooled pages back to the system. */
+void jtag_command_queue_free(void);
 
 void jtag_scan_field_clone(struct scan_field *dst, const struct scan_field *src);
 enum scan_type jtag_scan_type(const struct scan_command *cmd);
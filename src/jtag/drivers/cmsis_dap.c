@@ -40,6 +40,7 @@
 
 #include <transport/transport.h>
 #include "helper/replacements.h"
+#include <helper/time_support.h>
 #include <jtag/adapter.h>
 #include <jtag/swd.h>
 #include <jtag/interface.h>
@@ -242,10 +243,6 @@ struct pending_scan_result {
 	unsigned buffer_offset;
 };
 
-/* Up to MIN(packet_count, MAX_PENDING_REQUESTS) requests may be issued
- * until the first response arrives */
-#define MAX_PENDING_REQUESTS 3
-
 /* Pending requests are organized as a FIFO - circular buffer */
 /* Each block in FIFO can contain up to pending_queue_len transfers */
 static int pending_queue_len;
@@ -253,6 +250,14 @@ static struct pending_request_block pending_fifo[MAX_PENDING_REQUESTS];
 static int pending_fifo_put_idx, pending_fifo_get_idx;
 static int pending_fifo_block_count;
 
+/* Pipelining statistics, see 'cmsis-dap stats' */
+static struct {
+	unsigned int max_in_flight;	/* deepest the FIFO got */
+	uint64_t packets;			/* transfer packets sent */
+	uint64_t stalls;			/* blocking waits for a response */
+	float stall_time;			/* seconds spent in those waits */
+} pending_stats;
+
 /* pointers to buffers that will receive jtag scan results on the next flush */
 #define MAX_PENDING_SCAN_RESULTS 256
 static int pending_scan_result_count;
@@ -345,13 +350,33 @@ static void cmsis_dap_flush_read(struct cmsis_dap *dap)
 		LOG_DEBUG("Flushed %u packets", i);
 }
 
+/* The probe stopped answering: drop the requests still in flight and
+ * discard any response it sends late, so the next command starts in sync */
+static void cmsis_dap_abort_pending(struct cmsis_dap *dap)
+{
+	if (dap->backend->cancel_all)
+		dap->backend->cancel_all(dap);
+	cmsis_dap_flush_read(dap);
+
+	for (int i = 0; i < MAX_PENDING_REQUESTS; i++)
+		pending_fifo[i].transfer_count = 0;
+	pending_fifo_block_count = 0;
+	pending_fifo_put_idx = 0;
+	pending_fifo_get_idx = 0;
+}
+
 /* Send a message and receive the reply */
 static int cmsis_dap_xfer(struct cmsis_dap *dap, int txlen)
 {
 	if (pending_fifo_block_count) {
 		LOG_ERROR("pending %d blocks, flushing", pending_fifo_block_count);
+		/* the probe answers every request, read the responses so
+		 * they aren't taken for the reply to the next command */
 		while (pending_fifo_block_count) {
-			dap->backend->read(dap, 10);
+			if (dap->backend->read(dap, LIBUSB_TIMEOUT_MS) < 0) {
+				cmsis_dap_abort_pending(dap);
+				break;
+			}
 			pending_fifo_block_count--;
 		}
 		pending_fifo_put_idx = 0;
@@ -838,6 +863,10 @@ static void cmsis_dap_swd_write_from_queue(struct cmsis_dap *dap)
 	if (pending_fifo_block_count > dap->packet_count)
 		LOG_ERROR("too much pending writes %d", pending_fifo_block_count);
 
+	pending_stats.packets++;
+	if ((unsigned int)pending_fifo_block_count > pending_stats.max_in_flight)
+		pending_stats.max_in_flight = pending_fifo_block_count;
+
 	return;
 
 skip:
@@ -852,11 +881,27 @@ static void cmsis_dap_swd_read_process(struct cmsis_dap *dap, int timeout_ms)
 		LOG_ERROR("no pending write");
 
 	/* get reply */
+	struct duration stall;
+	if (timeout_ms)
+		duration_start(&stall);
+
 	int retval = dap->backend->read(dap, timeout_ms);
 	if (retval == ERROR_TIMEOUT_REACHED && timeout_ms < LIBUSB_TIMEOUT_MS)
 		return;
 
-	if (retval <= 0) {
+	if (timeout_ms && duration_measure(&stall) == ERROR_OK) {
+		pending_stats.stalls++;
+		pending_stats.stall_time += duration_elapsed(&stall);
+	}
+
+	if (retval < 0) {
+		LOG_DEBUG("error reading data");
+		queued_retval = ERROR_FAIL;
+		cmsis_dap_abort_pending(dap);
+		return;
+	}
+
+	if (retval == 0) {
 		LOG_DEBUG("error reading data");
 		queued_retval = ERROR_FAIL;
 		goto skip;
@@ -1241,6 +1286,7 @@ static int cmsis_dap_init(void)
 
 	if (data[0] == 1) { /* byte */
 		int pkt_cnt = data[1];
+		/* keep as many requests in flight as the adapter can buffer */
 		if (pkt_cnt > 1)
 			cmsis_dap_handle->packet_count = MIN(MAX_PENDING_REQUESTS, pkt_cnt);
 
@@ -2001,6 +2047,28 @@ COMMAND_HANDLER(cmsis_dap_handle_info_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(cmsis_dap_handle_stats_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		memset(&pending_stats, 0, sizeof(pending_stats));
+		return ERROR_OK;
+	}
+
+	command_print(CMD, "in-flight depth: %d (max seen %u)",
+			cmsis_dap_handle ? cmsis_dap_handle->packet_count : 0,
+			pending_stats.max_in_flight);
+	command_print(CMD, "packets: %" PRIu64 ", stalls: %" PRIu64 " (%.3f s)",
+			pending_stats.packets, pending_stats.stalls,
+			(double)pending_stats.stall_time);
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(cmsis_dap_handle_cmd_command)
 {
 	uint8_t *command = cmsis_dap_handle->command;
@@ -2089,6 +2157,13 @@ static const struct command_registration cmsis_dap_subcommand_handlers[] = {
 		.usage = "",
 		.help = "issue cmsis-dap command",
 	},
+	{
+		.name = "stats",
+		.handler = &cmsis_dap_handle_stats_command,
+		.mode = COMMAND_EXEC,
+		.usage = "['reset']",
+		.help = "show or reset the request pipelining statistics",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
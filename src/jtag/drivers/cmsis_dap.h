@@ -29,6 +29,8 @@ struct cmsis_dap_backend {
 	int (*read)(struct cmsis_dap *dap, int timeout_ms);
 	int (*write)(struct cmsis_dap *dap, int len, int timeout_ms);
 	int (*packet_buffer_alloc)(struct cmsis_dap *dap, unsigned int pkt_sz);
+	/* optional, drop all requests still in flight when the probe stops answering */
+	void (*cancel_all)(struct cmsis_dap *dap);
 };
 
 extern const struct cmsis_dap_backend cmsis_dap_hid_backend;
@@ -37,4 +39,8 @@ extern const struct command_registration cmsis_dap_usb_subcommand_handlers[];
 
 #define REPORT_ID_SIZE   1
 
+/* Up to MIN(packet_count, MAX_PENDING_REQUESTS) requests may be issued
+ * until the first response arrives */
+#define MAX_PENDING_REQUESTS 16
+
 #endif
@@ -39,8 +39,17 @@
 #include <libusb.h>
 #include <helper/log.h>
 #include <helper/replacements.h>
+#include <helper/time_support.h>
 
 #include "cmsis_dap.h"
+#include "libusb_helper.h"
+
+/* One asynchronous bulk transfer and its own data buffer */
+struct cmsis_dap_usb_xfer {
+	struct libusb_transfer *transfer;
+	uint8_t *buffer;
+	int completed;
+};
 
 struct cmsis_dap_backend_data {
 	struct libusb_context *usb_ctx;
@@ -48,12 +57,23 @@ struct cmsis_dap_backend_data {
 	unsigned int ep_out;
 	unsigned int ep_in;
 	int interface;
+
+	/* Each write submits the command and, right behind it, the transfer
+	 * for its response, so the adapter never waits for the host between
+	 * requests. Reads then complete the responses in order. */
+	struct cmsis_dap_usb_xfer command_xfers[MAX_PENDING_REQUESTS];
+	struct cmsis_dap_usb_xfer response_xfers[MAX_PENDING_REQUESTS];
+	unsigned int put_idx, get_idx;
+	unsigned int pending;
 };
 
 static int cmsis_dap_usb_interface = -1;
 
 static void cmsis_dap_usb_close(struct cmsis_dap *dap);
 static int cmsis_dap_usb_alloc(struct cmsis_dap *dap, unsigned int pkt_sz);
+static int cmsis_dap_usb_alloc_xfers(struct cmsis_dap *dap, unsigned int pkt_sz);
+static void cmsis_dap_usb_free_xfers(struct cmsis_dap *dap);
+static void cmsis_dap_usb_cancel_all(struct cmsis_dap *dap);
 
 static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t pids[], const char *serial)
 {
@@ -352,7 +372,7 @@ static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t p
 			if (err)
 				LOG_WARNING("could not claim interface: %s", libusb_strerror(err));
 
-			dap->bdata = malloc(sizeof(struct cmsis_dap_backend_data));
+			dap->bdata = calloc(1, sizeof(struct cmsis_dap_backend_data));
 			if (!dap->bdata) {
 				LOG_ERROR("unable to allocate memory");
 				libusb_release_interface(dev_handle, interface_num);
@@ -379,6 +399,11 @@ static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t p
 			dap->command = dap->packet_buffer;
 			dap->response = dap->packet_buffer;
 
+			if (cmsis_dap_usb_alloc_xfers(dap, packet_size) != ERROR_OK) {
+				cmsis_dap_usb_close(dap);
+				return ERROR_FAIL;
+			}
+
 			return ERROR_OK;
 		}
 
@@ -393,6 +418,8 @@ static int cmsis_dap_usb_open(struct cmsis_dap *dap, uint16_t vids[], uint16_t p
 
 static void cmsis_dap_usb_close(struct cmsis_dap *dap)
 {
+	cmsis_dap_usb_cancel_all(dap);
+	cmsis_dap_usb_free_xfers(dap);
 	libusb_release_interface(dap->bdata->dev_handle, dap->bdata->interface);
 	libusb_close(dap->bdata->dev_handle);
 	libusb_exit(dap->bdata->usb_ctx);
@@ -402,22 +429,161 @@ static void cmsis_dap_usb_close(struct cmsis_dap *dap)
 	dap->packet_buffer = NULL;
 }
 
+static void LIBUSB_CALL cmsis_dap_usb_xfer_done(struct libusb_transfer *transfer)
+{
+	struct cmsis_dap_usb_xfer *xfer = transfer->user_data;
+
+	xfer->completed = 1;
+}
+
+static void cmsis_dap_usb_free_xfers(struct cmsis_dap *dap)
+{
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
+
+	for (unsigned int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+		libusb_free_transfer(bdata->command_xfers[i].transfer);
+		libusb_free_transfer(bdata->response_xfers[i].transfer);
+		free(bdata->command_xfers[i].buffer);
+		free(bdata->response_xfers[i].buffer);
+		bdata->command_xfers[i].transfer = NULL;
+		bdata->response_xfers[i].transfer = NULL;
+		bdata->command_xfers[i].buffer = NULL;
+		bdata->response_xfers[i].buffer = NULL;
+	}
+}
+
+static int cmsis_dap_usb_alloc_xfers(struct cmsis_dap *dap, unsigned int pkt_sz)
+{
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
+
+	cmsis_dap_usb_free_xfers(dap);
+
+	for (unsigned int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+		struct cmsis_dap_usb_xfer *cmd = &bdata->command_xfers[i];
+		struct cmsis_dap_usb_xfer *rsp = &bdata->response_xfers[i];
+
+		cmd->transfer = libusb_alloc_transfer(0);
+		rsp->transfer = libusb_alloc_transfer(0);
+		cmd->buffer = malloc(pkt_sz);
+		rsp->buffer = malloc(pkt_sz);
+		if (!cmd->transfer || !rsp->transfer || !cmd->buffer || !rsp->buffer) {
+			LOG_ERROR("unable to allocate CMSIS-DAP transfers");
+			cmsis_dap_usb_free_xfers(dap);
+			return ERROR_FAIL;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+/* Handle libusb events until the transfer completes or timeout_ms expires */
+static int cmsis_dap_usb_wait(struct cmsis_dap *dap, struct cmsis_dap_usb_xfer *xfer, int timeout_ms)
+{
+	int64_t end = timeval_ms() + timeout_ms;
+
+	while (!xfer->completed) {
+		int64_t left = end - timeval_ms();
+		if (left < 0)
+			left = 0;
+
+		struct timeval tv = {
+			.tv_sec = left / 1000,
+			.tv_usec = (left % 1000) * 1000,
+		};
+		int err = libusb_handle_events_timeout_completed(dap->bdata->usb_ctx, &tv, &xfer->completed);
+		if (err && err != LIBUSB_ERROR_INTERRUPTED) {
+			LOG_ERROR("error handling USB events: %s", libusb_strerror(err));
+			return ERROR_FAIL;
+		}
+
+		if (!xfer->completed && !left)
+			return ERROR_TIMEOUT_REACHED;
+	}
+
+	return ERROR_OK;
+}
+
+static void cmsis_dap_usb_cancel(struct cmsis_dap *dap, struct cmsis_dap_usb_xfer *xfer)
+{
+	if (xfer->completed)
+		return;
+
+	libusb_cancel_transfer(xfer->transfer);
+	cmsis_dap_usb_wait(dap, xfer, LIBUSB_TIMEOUT_MS);
+}
+
+static void cmsis_dap_usb_cancel_all(struct cmsis_dap *dap)
+{
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
+
+	while (bdata->pending) {
+		cmsis_dap_usb_cancel(dap, &bdata->command_xfers[bdata->get_idx]);
+		cmsis_dap_usb_cancel(dap, &bdata->response_xfers[bdata->get_idx]);
+		bdata->get_idx = (bdata->get_idx + 1) % MAX_PENDING_REQUESTS;
+		bdata->pending--;
+	}
+
+	bdata->put_idx = 0;
+	bdata->get_idx = 0;
+}
+
 static int cmsis_dap_usb_read(struct cmsis_dap *dap, int timeout_ms)
 {
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
 	int transferred = 0;
 	int err;
 
-	err = libusb_bulk_transfer(dap->bdata->dev_handle, dap->bdata->ep_in,
-							dap->packet_buffer, dap->packet_size, &transferred, timeout_ms);
-	if (err) {
-		if (err == LIBUSB_ERROR_TIMEOUT) {
-			return ERROR_TIMEOUT_REACHED;
-		} else {
-			LOG_ERROR("error reading data: %s", libusb_strerror(err));
-			return ERROR_FAIL;
+	if (!bdata->pending) {
+		/* nothing submitted, e.g. draining stale responses */
+		err = libusb_bulk_transfer(bdata->dev_handle, bdata->ep_in,
+								dap->packet_buffer, dap->packet_size, &transferred, timeout_ms);
+		if (err) {
+			if (err == LIBUSB_ERROR_TIMEOUT) {
+				return ERROR_TIMEOUT_REACHED;
+			} else {
+				LOG_ERROR("error reading data: %s", libusb_strerror(err));
+				return ERROR_FAIL;
+			}
 		}
+
+		memset(&dap->packet_buffer[transferred], 0, dap->packet_buffer_size - transferred);
+
+		return transferred;
 	}
 
+	struct cmsis_dap_usb_xfer *cmd = &bdata->command_xfers[bdata->get_idx];
+	struct cmsis_dap_usb_xfer *rsp = &bdata->response_xfers[bdata->get_idx];
+
+	int retval = cmsis_dap_usb_wait(dap, cmd, timeout_ms);
+	if (retval == ERROR_OK && cmd->transfer->status == LIBUSB_TRANSFER_COMPLETED)
+		retval = cmsis_dap_usb_wait(dap, rsp, timeout_ms);
+	if (retval == ERROR_TIMEOUT_REACHED)
+		return retval;	/* still in flight, try again later */
+
+	/* a failed command never gets a response */
+	cmsis_dap_usb_cancel(dap, rsp);
+
+	bdata->get_idx = (bdata->get_idx + 1) % MAX_PENDING_REQUESTS;
+	bdata->pending--;
+
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* The slot is gone now, so even a transfer that timed out in libusb is a
+	 * failure: ERROR_TIMEOUT_REACHED would make the caller retry a read for a
+	 * response that will never arrive in this slot. */
+	if (cmd->transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		LOG_ERROR("error writing data: transfer status %d", cmd->transfer->status);
+		return ERROR_FAIL;
+	}
+
+	if (rsp->transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		LOG_ERROR("error reading data: transfer status %d", rsp->transfer->status);
+		return ERROR_FAIL;
+	}
+
+	transferred = rsp->transfer->actual_length;
+	memcpy(dap->packet_buffer, rsp->buffer, transferred);
 	memset(&dap->packet_buffer[transferred], 0, dap->packet_buffer_size - transferred);
 
 	return transferred;
@@ -425,22 +591,42 @@ static int cmsis_dap_usb_read(struct cmsis_dap *dap, int timeout_ms)
 
 static int cmsis_dap_usb_write(struct cmsis_dap *dap, int txlen, int timeout_ms)
 {
-	int transferred = 0;
+	struct cmsis_dap_backend_data *bdata = dap->bdata;
 	int err;
 
-	/* skip the first byte that is only used by the HID backend */
-	err = libusb_bulk_transfer(dap->bdata->dev_handle, dap->bdata->ep_out,
-							dap->packet_buffer, txlen, &transferred, timeout_ms);
+	if (bdata->pending == MAX_PENDING_REQUESTS) {
+		LOG_ERROR("too many CMSIS-DAP requests in flight");
+		return ERROR_FAIL;
+	}
+
+	struct cmsis_dap_usb_xfer *cmd = &bdata->command_xfers[bdata->put_idx];
+	struct cmsis_dap_usb_xfer *rsp = &bdata->response_xfers[bdata->put_idx];
+
+	/* the packet buffer is reused for the next command right away */
+	memcpy(cmd->buffer, dap->packet_buffer, txlen);
+	cmd->completed = 0;
+	libusb_fill_bulk_transfer(cmd->transfer, bdata->dev_handle, bdata->ep_out,
+			cmd->buffer, txlen, cmsis_dap_usb_xfer_done, cmd, timeout_ms);
+	err = libusb_submit_transfer(cmd->transfer);
 	if (err) {
-		if (err == LIBUSB_ERROR_TIMEOUT) {
-			return ERROR_TIMEOUT_REACHED;
-		} else {
-			LOG_ERROR("error writing data: %s", libusb_strerror(err));
-			return ERROR_FAIL;
-		}
+		LOG_ERROR("error writing data: %s", libusb_strerror(err));
+		return ERROR_FAIL;
 	}
 
-	return transferred;
+	rsp->completed = 0;
+	libusb_fill_bulk_transfer(rsp->transfer, bdata->dev_handle, bdata->ep_in,
+			rsp->buffer, dap->packet_size, cmsis_dap_usb_xfer_done, rsp, LIBUSB_TIMEOUT_MS);
+	err = libusb_submit_transfer(rsp->transfer);
+	if (err) {
+		LOG_ERROR("error reading data: %s", libusb_strerror(err));
+		cmsis_dap_usb_cancel(dap, cmd);
+		return ERROR_FAIL;
+	}
+
+	bdata->put_idx = (bdata->put_idx + 1) % MAX_PENDING_REQUESTS;
+	bdata->pending++;
+
+	return txlen;
 }
 
 static int cmsis_dap_usb_alloc(struct cmsis_dap *dap, unsigned int pkt_sz)
@@ -458,7 +644,7 @@ static int cmsis_dap_usb_alloc(struct cmsis_dap *dap, unsigned int pkt_sz)
 	dap->command = dap->packet_buffer;
 	dap->response = dap->packet_buffer;
 
-	return ERROR_OK;
+	return cmsis_dap_usb_alloc_xfers(dap, pkt_sz);
 }
 
 COMMAND_HANDLER(cmsis_dap_handle_usb_interface_command)
@@ -489,4 +675,5 @@ const struct cmsis_dap_backend cmsis_dap_usb_backend = {
 	.read = cmsis_dap_usb_read,
 	.write = cmsis_dap_usb_write,
 	.packet_buffer_alloc = cmsis_dap_usb_alloc,
+	.cancel_all = cmsis_dap_usb_cancel_all,
 };
@@ -92,6 +92,8 @@
 static char *ftdi_device_desc;
 static uint8_t ftdi_channel;
 static uint8_t ftdi_jtag_mode = JTAG_MODE;
+static uint8_t ftdi_latency_timer = 255;
+static unsigned int ftdi_transfer_depth = MPSSE_DEFAULT_TRANSFER_DEPTH;
 
 static bool swd_mode;
 
@@ -679,6 +681,10 @@ static int ftdi_initialize(void)
 	if (!mpsse_ctx)
 		return ERROR_JTAG_INIT_FAILED;
 
+	if (mpsse_set_latency_timer(mpsse_ctx, ftdi_latency_timer) != ERROR_OK ||
+			mpsse_set_transfer_depth(mpsse_ctx, ftdi_transfer_depth) != ERROR_OK)
+		return ERROR_JTAG_INIT_FAILED;
+
 	output = jtag_output_init;
 	direction = jtag_direction_init;
 
@@ -933,6 +939,55 @@ COMMAND_HANDLER(ftdi_handle_tdo_sample_edge_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(ftdi_handle_latency_timer_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		uint8_t latency;
+		COMMAND_PARSE_NUMBER(u8, CMD_ARGV[0], latency);
+		if (!latency)
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		if (mpsse_ctx) {
+			int retval = mpsse_set_latency_timer(mpsse_ctx, latency);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+		ftdi_latency_timer = latency;
+	}
+
+	command_print(CMD, "ftdi latency timer is %u ms", ftdi_latency_timer);
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(ftdi_handle_transfer_depth_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned int depth;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], depth);
+		if (depth < 1 || depth > MPSSE_MAX_TRANSFER_DEPTH) {
+			command_print(CMD, "transfer depth must be between 1 and %d",
+				MPSSE_MAX_TRANSFER_DEPTH);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		if (mpsse_ctx) {
+			int retval = mpsse_set_transfer_depth(mpsse_ctx, depth);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+		ftdi_transfer_depth = depth;
+	}
+
+	command_print(CMD, "ftdi transfer depth is %u", ftdi_transfer_depth);
+
+	return ERROR_OK;
+}
+
 static const struct command_registration ftdi_subcommand_handlers[] = {
 	{
 		.name = "device_desc",
@@ -994,6 +1049,21 @@ static const struct command_registration ftdi_subcommand_handlers[] = {
 			"allow signalling speed increase)",
 		.usage = "(rising|falling)",
 	},
+	{
+		.name = "latency_timer",
+		.handler = &ftdi_handle_latency_timer_command,
+		.mode = COMMAND_ANY,
+		.help = "set the FTDI latency timer in ms - default is 255",
+		.usage = "[(1-255)]",
+	},
+	{
+		.name = "transfer_depth",
+		.handler = &ftdi_handle_transfer_depth_command,
+		.mode = COMMAND_ANY,
+		.help = "set the number of USB transfers that may be in flight "
+			"while the next one is prepared",
+		.usage = "[(1-8)]",
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -62,6 +62,30 @@
 #define SIO_RESET_PURGE_RX 1
 #define SIO_RESET_PURGE_TX 2
 
+struct mpsse_transfer;
+
+/* Context needed by the callbacks */
+struct transfer_result {
+	struct mpsse_transfer *xfer;
+	bool done;
+	unsigned transferred;
+};
+
+/* A command buffer handed to libusb, together with the read data it produces */
+struct mpsse_transfer {
+	struct mpsse_ctx *ctx;
+	uint8_t *write_buffer;
+	unsigned write_count;
+	uint8_t *read_buffer;
+	unsigned read_count;
+	uint8_t *read_chunk;
+	struct bit_copy_queue read_queue;
+	struct libusb_transfer *write_transfer;
+	struct libusb_transfer *read_transfer;
+	struct transfer_result write_result;
+	struct transfer_result read_result;
+};
+
 struct mpsse_ctx {
 	struct libusb_context *usb_ctx;
 	struct libusb_device_handle *usb_dev;
@@ -83,8 +107,18 @@ struct mpsse_ctx {
 	unsigned read_chunk_size;
 	struct bit_copy_queue read_queue;
 	int retval;
+	/* Transfers handed to libusb, completed in order starting at transfer_head */
+	struct mpsse_transfer transfers[MPSSE_MAX_TRANSFER_DEPTH];
+	unsigned transfer_depth;
+	unsigned transfer_head;
+	unsigned transfers_in_flight;
+	unsigned reads_in_flight;
 };
 
+static int mpsse_submit(struct mpsse_ctx *ctx);
+static int mpsse_complete_transfers(struct mpsse_ctx *ctx, unsigned max_in_flight);
+static void mpsse_free_transfers(struct mpsse_ctx *ctx);
+
 /* Returns true if the string descriptor indexed by str_index in device matches string */
 static bool string_descriptor_equal(struct libusb_device_handle *device, uint8_t str_index,
 	const char *string)
@@ -347,6 +381,7 @@ struct mpsse_ctx *mpsse_open(const uint16_t *vid, const uint16_t *pid, const cha
 	ctx->index = channel + 1;
 	ctx->usb_read_timeout = 5000;
 	ctx->usb_write_timeout = 5000;
+	ctx->transfer_depth = MPSSE_DEFAULT_TRANSFER_DEPTH;
 
 	err = libusb_init(&ctx->usb_ctx);
 	if (err != LIBUSB_SUCCESS) {
@@ -400,8 +435,10 @@ error:
 
 void mpsse_close(struct mpsse_ctx *ctx)
 {
-	if (ctx->usb_dev)
+	if (ctx->usb_dev) {
+		mpsse_complete_transfers(ctx, 0);
 		libusb_close(ctx->usb_dev);
+	}
 	if (ctx->usb_ctx)
 		libusb_exit(ctx->usb_ctx);
 	bit_copy_discard(&ctx->read_queue);
@@ -409,6 +446,7 @@ void mpsse_close(struct mpsse_ctx *ctx)
 	free(ctx->write_buffer);
 	free(ctx->read_buffer);
 	free(ctx->read_chunk);
+	mpsse_free_transfers(ctx);
 	free(ctx);
 }
 
@@ -421,6 +459,7 @@ void mpsse_purge(struct mpsse_ctx *ctx)
 {
 	int err;
 	LOG_DEBUG("-");
+	mpsse_complete_transfers(ctx, 0);
 	ctx->write_count = 0;
 	ctx->read_count = 0;
 	ctx->retval = ERROR_OK;
@@ -512,7 +551,7 @@ void mpsse_clock_data(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_of
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) + (length < 8) < (out || (!out && !in) ? 4 : 3)
 				|| (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			ctx->retval = mpsse_submit(ctx);
 
 		if (length < 8) {
 			/* Transfer remaining bits in bit mode */
@@ -586,7 +625,7 @@ void mpsse_clock_tms_cs(struct mpsse_ctx *ctx, const uint8_t *out, unsigned out_
 	while (length > 0) {
 		/* Guarantee buffer space enough for a minimum size transfer */
 		if (buffer_write_space(ctx) < 3 || (in && buffer_read_space(ctx) < 1))
-			ctx->retval = mpsse_flush(ctx);
+			ctx->retval = mpsse_submit(ctx);
 
 		/* Byte transfer */
 		unsigned this_bits = length;
@@ -629,7 +668,7 @@ void mpsse_set_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t d
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x80);
 	buffer_write_byte(ctx, data);
@@ -646,7 +685,7 @@ void mpsse_set_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t data, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x82);
 	buffer_write_byte(ctx, data);
@@ -663,7 +702,7 @@ void mpsse_read_data_bits_low_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x81);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -679,7 +718,7 @@ void mpsse_read_data_bits_high_byte(struct mpsse_ctx *ctx, uint8_t *data)
 	}
 
 	if (buffer_write_space(ctx) < 1 || buffer_read_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x83);
 	buffer_add_read(ctx, data, 0, 8, 0);
@@ -694,7 +733,7 @@ static void single_byte_boolean_helper(struct mpsse_ctx *ctx, bool var, uint8_t
 	}
 
 	if (buffer_write_space(ctx) < 1)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, var ? val_if_true : val_if_false);
 }
@@ -715,7 +754,7 @@ void mpsse_set_divisor(struct mpsse_ctx *ctx, uint16_t divisor)
 	}
 
 	if (buffer_write_space(ctx) < 3)
-		ctx->retval = mpsse_flush(ctx);
+		ctx->retval = mpsse_submit(ctx);
 
 	buffer_write_byte(ctx, 0x86);
 	buffer_write_byte(ctx, divisor & 0xff);
@@ -775,19 +814,12 @@ int mpsse_set_frequency(struct mpsse_ctx *ctx, int frequency)
 	return frequency;
 }
 
-/* Context needed by the callbacks */
-struct transfer_result {
-	struct mpsse_ctx *ctx;
-	bool done;
-	unsigned transferred;
-};
-
 static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 {
 	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_transfer *xfer = res->xfer;
 
-	unsigned packet_size = ctx->max_packet_size;
+	unsigned packet_size = xfer->ctx->max_packet_size;
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
@@ -799,21 +831,21 @@ static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 		unsigned this_size = packet_size - 2;
 		if (this_size > chunk_remains - 2)
 			this_size = chunk_remains - 2;
-		if (this_size > ctx->read_count - res->transferred)
-			this_size = ctx->read_count - res->transferred;
-		memcpy(ctx->read_buffer + res->transferred,
-			ctx->read_chunk + packet_size * i + 2,
+		if (this_size > xfer->read_count - res->transferred)
+			this_size = xfer->read_count - res->transferred;
+		memcpy(xfer->read_buffer + res->transferred,
+			xfer->read_chunk + packet_size * i + 2,
 			this_size);
 		res->transferred += this_size;
 		chunk_remains -= this_size + 2;
-		if (res->transferred == ctx->read_count) {
+		if (res->transferred == xfer->read_count) {
 			res->done = true;
 			break;
 		}
 	}
 
 	LOG_DEBUG_IO("raw chunk %d, transferred %d of %d", transfer->actual_length, res->transferred,
-		ctx->read_count);
+		xfer->read_count);
 
 	if (!res->done)
 		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
@@ -823,73 +855,34 @@ static LIBUSB_CALL void read_cb(struct libusb_transfer *transfer)
 static LIBUSB_CALL void write_cb(struct libusb_transfer *transfer)
 {
 	struct transfer_result *res = transfer->user_data;
-	struct mpsse_ctx *ctx = res->ctx;
+	struct mpsse_transfer *xfer = res->xfer;
 
 	res->transferred += transfer->actual_length;
 
-	LOG_DEBUG_IO("transferred %d of %d", res->transferred, ctx->write_count);
+	LOG_DEBUG_IO("transferred %d of %d", res->transferred, xfer->write_count);
 
 	DEBUG_PRINT_BUF(transfer->buffer, transfer->actual_length);
 
-	if (res->transferred == ctx->write_count)
+	if (res->transferred == xfer->write_count)
 		res->done = true;
 	else {
-		transfer->length = ctx->write_count - res->transferred;
-		transfer->buffer = ctx->write_buffer + res->transferred;
+		transfer->length = xfer->write_count - res->transferred;
+		transfer->buffer = xfer->write_buffer + res->transferred;
 		if (libusb_submit_transfer(transfer) != LIBUSB_SUCCESS)
 			res->done = true;
 	}
 }
 
-int mpsse_flush(struct mpsse_ctx *ctx)
+/* Wait for the oldest transfer in flight and deliver its read data */
+static int mpsse_complete_transfer(struct mpsse_ctx *ctx, bool deliver)
 {
-	int retval = ctx->retval;
-
-	if (retval != ERROR_OK) {
-		LOG_DEBUG_IO("Ignoring flush due to previous error");
-		assert(ctx->write_count == 0 && ctx->read_count == 0);
-		ctx->retval = ERROR_OK;
-		return retval;
-	}
-
-	LOG_DEBUG_IO("write %d%s, read %d", ctx->write_count, ctx->read_count ? "+1" : "",
-			ctx->read_count);
-	assert(ctx->write_count > 0 || ctx->read_count == 0); /* No read data without write data */
-
-	if (ctx->write_count == 0)
-		return retval;
-
-	struct libusb_transfer *read_transfer = 0;
-	struct transfer_result read_result = { .ctx = ctx, .done = true };
-	if (ctx->read_count) {
-		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
-		read_result.done = false;
-		/* delay read transaction to ensure the FTDI chip can support us with data
-		   immediately after processing the MPSSE commands in the write transaction */
-	}
-
-	struct transfer_result write_result = { .ctx = ctx, .done = false };
-	struct libusb_transfer *write_transfer = libusb_alloc_transfer(0);
-	libusb_fill_bulk_transfer(write_transfer, ctx->usb_dev, ctx->out_ep, ctx->write_buffer,
-		ctx->write_count, write_cb, &write_result, ctx->usb_write_timeout);
-	retval = libusb_submit_transfer(write_transfer);
-	if (retval != LIBUSB_SUCCESS)
-		goto error_check;
-
-	if (ctx->read_count) {
-		read_transfer = libusb_alloc_transfer(0);
-		libusb_fill_bulk_transfer(read_transfer, ctx->usb_dev, ctx->in_ep, ctx->read_chunk,
-			ctx->read_chunk_size, read_cb, &read_result,
-			ctx->usb_read_timeout);
-		retval = libusb_submit_transfer(read_transfer);
-		if (retval != LIBUSB_SUCCESS)
-			goto error_check;
-	}
+	struct mpsse_transfer *xfer = &ctx->transfers[ctx->transfer_head];
+	int retval = LIBUSB_SUCCESS;
 
 	/* Polling loop, more or less taken from libftdi */
 	int64_t start = timeval_ms();
 	int64_t warn_after = 2000;
-	while (!write_result.done || !read_result.done) {
+	while (!xfer->write_result.done || !xfer->read_result.done) {
 		struct timeval timeout_usb;
 
 		timeout_usb.tv_sec = 1;
@@ -901,10 +894,10 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 			break;
 
 		if (retval != LIBUSB_SUCCESS) {
-			libusb_cancel_transfer(write_transfer);
-			if (read_transfer)
-				libusb_cancel_transfer(read_transfer);
-			while (!write_result.done || !read_result.done) {
+			libusb_cancel_transfer(xfer->write_transfer);
+			if (xfer->read_transfer)
+				libusb_cancel_transfer(xfer->read_transfer);
+			while (!xfer->write_result.done || !xfer->read_result.done) {
 				retval = libusb_handle_events_timeout_completed(ctx->usb_ctx,
 								&timeout_usb, NULL);
 				if (retval != LIBUSB_SUCCESS)
@@ -920,37 +913,219 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 		}
 	}
 
-error_check:
 	if (retval != LIBUSB_SUCCESS) {
 		LOG_ERROR("libusb_handle_events() failed with %s", libusb_error_name(retval));
 		retval = ERROR_FAIL;
-	} else if (write_result.transferred < ctx->write_count) {
+	} else if (xfer->write_result.transferred < xfer->write_count) {
 		LOG_ERROR("ftdi device did not accept all data: %d, tried %d",
-			write_result.transferred,
-			ctx->write_count);
+			xfer->write_result.transferred,
+			xfer->write_count);
 		retval = ERROR_FAIL;
-	} else if (read_result.transferred < ctx->read_count) {
+	} else if (xfer->read_result.transferred < xfer->read_count) {
 		LOG_ERROR("ftdi device did not return all data: %d, expected %d",
-			read_result.transferred,
-			ctx->read_count);
+			xfer->read_result.transferred,
+			xfer->read_count);
 		retval = ERROR_FAIL;
-	} else if (ctx->read_count) {
-		ctx->write_count = 0;
-		ctx->read_count = 0;
-		bit_copy_execute(&ctx->read_queue);
-		retval = ERROR_OK;
 	} else {
-		ctx->write_count = 0;
-		bit_copy_discard(&ctx->read_queue);
 		retval = ERROR_OK;
 	}
 
+	if (retval == ERROR_OK && deliver && xfer->read_count)
+		bit_copy_execute(&xfer->read_queue);
+	else
+		bit_copy_discard(&xfer->read_queue);
+
+	libusb_free_transfer(xfer->write_transfer);
+	xfer->write_transfer = NULL;
+	if (xfer->read_transfer) {
+		libusb_free_transfer(xfer->read_transfer);
+		xfer->read_transfer = NULL;
+		ctx->reads_in_flight--;
+	}
+
+	ctx->transfer_head = (ctx->transfer_head + 1) % ctx->transfer_depth;
+	ctx->transfers_in_flight--;
+
+	return retval;
+}
+
+/* Wait until no more than max_in_flight transfers are in flight. Once a
+ * transfer failed, the read data of the following ones is discarded. */
+static int mpsse_complete_transfers(struct mpsse_ctx *ctx, unsigned max_in_flight)
+{
+	int retval = ERROR_OK;
+
+	while (ctx->transfers_in_flight > max_in_flight) {
+		int retval2 = mpsse_complete_transfer(ctx, retval == ERROR_OK);
+		if (retval == ERROR_OK)
+			retval = retval2;
+	}
+
+	return retval;
+}
+
+static void mpsse_free_transfers(struct mpsse_ctx *ctx)
+{
+	for (unsigned i = 0; i < MPSSE_MAX_TRANSFER_DEPTH; i++) {
+		free(ctx->transfers[i].write_buffer);
+		free(ctx->transfers[i].read_buffer);
+		free(ctx->transfers[i].read_chunk);
+		ctx->transfers[i].write_buffer = NULL;
+		ctx->transfers[i].read_buffer = NULL;
+		ctx->transfers[i].read_chunk = NULL;
+	}
+}
+
+/* Hand the queued commands to libusb without waiting for them to complete,
+ * unless the maximum number of transfers is already in flight */
+static int mpsse_submit(struct mpsse_ctx *ctx)
+{
+	int retval;
+
+	if (ctx->write_count == 0)
+		return ERROR_OK;
+
+	/* Read data of consecutive transfers could end up in the same USB packet,
+	 * so only one transfer with read data may be in flight at any time */
+	while (ctx->transfers_in_flight >= ctx->transfer_depth
+			|| (ctx->read_count && ctx->reads_in_flight)) {
+		retval = mpsse_complete_transfers(ctx, ctx->transfers_in_flight - 1);
+		if (retval != ERROR_OK)
+			goto error;
+	}
+
+	struct mpsse_transfer *xfer = &ctx->transfers[(ctx->transfer_head + ctx->transfers_in_flight)
+		% ctx->transfer_depth];
+
+	if (!xfer->write_buffer) {
+		/* See mpsse_open() for calloc */
+		xfer->write_buffer = calloc(1, ctx->write_size);
+		xfer->read_buffer = malloc(ctx->read_size);
+		xfer->read_chunk = malloc(ctx->read_chunk_size);
+		if (!xfer->write_buffer || !xfer->read_buffer || !xfer->read_chunk) {
+			LOG_ERROR("Out of memory");
+			retval = ERROR_FAIL;
+			goto error;
+		}
+		bit_copy_queue_init(&xfer->read_queue);
+	}
+
+	if (ctx->read_count)
+		buffer_write_byte(ctx, 0x87); /* SEND_IMMEDIATE */
+
+	/* Swap the buffers, the queued bit copies point into the read buffer */
+	uint8_t *tmp = xfer->write_buffer;
+	xfer->write_buffer = ctx->write_buffer;
+	ctx->write_buffer = tmp;
+	tmp = xfer->read_buffer;
+	xfer->read_buffer = ctx->read_buffer;
+	ctx->read_buffer = tmp;
+	tmp = xfer->read_chunk;
+	xfer->read_chunk = ctx->read_chunk;
+	ctx->read_chunk = tmp;
+	list_splice_init(&ctx->read_queue.list, &xfer->read_queue.list);
+
+	xfer->ctx = ctx;
+	xfer->write_count = ctx->write_count;
+	xfer->read_count = ctx->read_count;
+	xfer->write_result = (struct transfer_result){ .xfer = xfer, .done = false };
+	xfer->read_result = (struct transfer_result){ .xfer = xfer, .done = !ctx->read_count };
+	xfer->read_transfer = NULL;
+	ctx->write_count = 0;
+	ctx->read_count = 0;
+	ctx->transfers_in_flight++;
+
+	xfer->write_transfer = libusb_alloc_transfer(0);
+	libusb_fill_bulk_transfer(xfer->write_transfer, ctx->usb_dev, ctx->out_ep, xfer->write_buffer,
+		xfer->write_count, write_cb, &xfer->write_result, ctx->usb_write_timeout);
+	retval = libusb_submit_transfer(xfer->write_transfer);
+	if (retval != LIBUSB_SUCCESS) {
+		/* Reported as missing data when the transfer is completed */
+		LOG_ERROR("libusb_submit_transfer() failed with %s", libusb_error_name(retval));
+		xfer->write_result.done = true;
+		xfer->read_result.done = true;
+	}
+
+	/* delay read transaction to ensure the FTDI chip can support us with data
+	   immediately after processing the MPSSE commands in the write transaction */
+	if (xfer->read_count) {
+		xfer->read_transfer = libusb_alloc_transfer(0);
+		ctx->reads_in_flight++;
+		if (!xfer->read_result.done) {
+			libusb_fill_bulk_transfer(xfer->read_transfer, ctx->usb_dev, ctx->in_ep,
+				xfer->read_chunk, ctx->read_chunk_size, read_cb, &xfer->read_result,
+				ctx->usb_read_timeout);
+			retval = libusb_submit_transfer(xfer->read_transfer);
+			if (retval != LIBUSB_SUCCESS) {
+				LOG_ERROR("libusb_submit_transfer() failed with %s", libusb_error_name(retval));
+				xfer->read_result.done = true;
+			}
+		}
+	}
+
+	retval = mpsse_complete_transfers(ctx, ctx->transfer_depth - 1);
 	if (retval != ERROR_OK)
-		mpsse_purge(ctx);
+		goto error;
+
+	return ERROR_OK;
+
+error:
+	mpsse_complete_transfers(ctx, 0);
+	mpsse_purge(ctx);
+	return retval;
+}
+
+int mpsse_flush(struct mpsse_ctx *ctx)
+{
+	int retval = ctx->retval;
+
+	if (retval != ERROR_OK) {
+		LOG_DEBUG_IO("Ignoring flush due to previous error");
+		assert(ctx->write_count == 0 && ctx->read_count == 0);
+		ctx->retval = ERROR_OK;
+		return retval;
+	}
 
-	libusb_free_transfer(write_transfer);
-	if (read_transfer)
-		libusb_free_transfer(read_transfer);
+	LOG_DEBUG_IO("write %d%s, read %d", ctx->write_count, ctx->read_count ? "+1" : "",
+			ctx->read_count);
+	assert(ctx->write_count > 0 || ctx->read_count == 0); /* No read data without write data */
+
+	retval = mpsse_submit(ctx);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = mpsse_complete_transfers(ctx, 0);
+	if (retval != ERROR_OK)
+		mpsse_purge(ctx);
 
 	return retval;
 }
+
+int mpsse_set_transfer_depth(struct mpsse_ctx *ctx, unsigned depth)
+{
+	if (depth < 1 || depth > MPSSE_MAX_TRANSFER_DEPTH)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	int retval = mpsse_flush(ctx);
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* Nothing is in flight, restart the ring at the first entry */
+	ctx->transfer_depth = depth;
+	ctx->transfer_head = 0;
+
+	return ERROR_OK;
+}
+
+int mpsse_set_latency_timer(struct mpsse_ctx *ctx, uint8_t latency)
+{
+	int err = libusb_control_transfer(ctx->usb_dev, FTDI_DEVICE_OUT_REQTYPE,
+			SIO_SET_LATENCY_TIMER_REQUEST, latency, ctx->index, NULL, 0,
+			ctx->usb_write_timeout);
+	if (err < 0) {
+		LOG_ERROR("unable to set latency timer: %s", libusb_error_name(err));
+		return ERROR_FAIL;
+	}
+
+	return ERROR_OK;
+}
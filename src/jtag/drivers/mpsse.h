@@ -30,6 +30,10 @@
 #define MSB_FIRST 0x00
 #define LSB_FIRST 0x08
 
+/* Number of command buffers that may be in flight on the USB bus */
+#define MPSSE_MAX_TRANSFER_DEPTH 8
+#define MPSSE_DEFAULT_TRANSFER_DEPTH 2
+
 enum ftdi_chip_type {
 	TYPE_FT2232C,
 	TYPE_FT2232H,
@@ -71,6 +75,13 @@ int mpsse_rtck_config(struct mpsse_ctx *ctx, bool enable);
  * Frequency 0 means RTCK. */
 int mpsse_set_frequency(struct mpsse_ctx *ctx, int frequency);
 
+/* Set the FTDI latency timer in milliseconds */
+int mpsse_set_latency_timer(struct mpsse_ctx *ctx, uint8_t latency);
+
+/* Set how many command buffers may be in flight while the next one is built. 1 waits for each
+ * buffer to complete before returning. */
+int mpsse_set_transfer_depth(struct mpsse_ctx *ctx, unsigned depth);
+
 /* Queue handling */
 int mpsse_flush(struct mpsse_ctx *ctx);
 void mpsse_purge(struct mpsse_ctx *ctx);
@@ -61,6 +61,10 @@
 
 #define NULINK_SERIAL_LEN	(32)
 
+/* Memory access reports kept in flight. Neither firmware documents how many
+ * unanswered reports it buffers, so only one is sent at a time. */
+#define NULINK_MAX_PENDING	1
+
 struct nulink_usb_handle_s {
 	struct libusb_device_handle *fd;
 	struct libusb_transfer *trans;
@@ -69,7 +73,7 @@ struct nulink_usb_handle_s {
 	uint8_t tx_ep;
 	uint16_t max_packet_size;
 	uint32_t usbcmdidx;
-	uint8_t cmdidx;
+	uint16_t cmdidx;
 	uint8_t cmdsize;
 	uint8_t cmdbuf[NULINK2_HID_MAX_SIZE];
 	uint8_t tempbuf[NULINK2_HID_MAX_SIZE];
@@ -86,6 +90,7 @@ struct nulink_usb_handle_s {
 struct nulink_usb_internal_api_s {
 	int (*nulink_usb_xfer) (void *handle, uint8_t *buf, int size);
 	void (*nulink_usb_init_buffer) (void *handle, uint32_t size);
+	int (*nulink_usb_recv) (void *handle, uint8_t seq, int size, uint8_t *buf);
 } m_nulink_usb_api;
 
 /* ICE Command */
@@ -330,6 +335,55 @@ static int nulink2_usb_xfer(void *handle, uint8_t *buf, int size)
 	return err;
 }
 
+/* Send the report in cmdbuf without waiting for its reply */
+static int nulink_usb_send(void *handle)
+{
+	struct nulink_usb_handle_s *h = handle;
+	int transferred;
+
+	return jtag_libusb_interrupt_write(h->fd, h->tx_ep, (char *)h->cmdbuf, h->max_packet_size,
+		NULINK_WRITE_TIMEOUT, &transferred);
+}
+
+/* Wait for the reply to the RAM command sent with sequence number seq,
+ * dropping any stale report, and copy its payload to buf */
+static int nulink1_usb_recv(void *handle, uint8_t seq, int size, uint8_t *buf)
+{
+	struct nulink_usb_handle_s *h = handle;
+	double start_time = GetTickCount();
+	int transferred;
+
+	do {
+		jtag_libusb_interrupt_read(h->fd, h->rx_ep, (char *)h->tempbuf,
+			h->max_packet_size, NULINK_READ_TIMEOUT, &transferred);
+		if (GetTickCount() - start_time > USBCMD_TIMEOUT)
+			return ERROR_FAIL;
+	} while (seq != (h->tempbuf[0] & 0x7F) || size != h->tempbuf[1]);
+
+	memcpy(buf, h->tempbuf + 2, h->max_packet_size - 2);
+
+	return ERROR_OK;
+}
+
+static int nulink2_usb_recv(void *handle, uint8_t seq, int size, uint8_t *buf)
+{
+	struct nulink_usb_handle_s *h = handle;
+	double start_time = GetTickCount();
+	int transferred;
+
+	do {
+		jtag_libusb_interrupt_read(h->fd, h->rx_ep, (char *)h->tempbuf,
+			h->max_packet_size, NULINK_READ_TIMEOUT, &transferred);
+		if (GetTickCount() - start_time > USBCMD_TIMEOUT)
+			return ERROR_FAIL;
+	} while (seq != (h->tempbuf[0] & 0x7F) ||
+			size != (((int)h->tempbuf[1]) << 8) + ((int)h->tempbuf[2] & 0xFF));
+
+	memcpy(buf, h->tempbuf + 3, h->max_packet_size - 3);
+
+	return ERROR_OK;
+}
+
 static void nulink1_usb_init_buffer(void *handle, uint32_t size)
 {
 	struct nulink_usb_handle_s *h = handle;
@@ -1020,82 +1074,115 @@ static int nulink_usb_write_mem8(void *handle, uint32_t addr, uint16_t len,
 	return res;
 }
 
-static int nulink_usb_read_mem32(void *handle, uint32_t addr, uint16_t len,
-		uint8_t *buffer)
+/* Number of words one CMD_WRITE_RAM report can carry: after the report and
+ * command headers each word takes 12 bytes (address, data, mask) */
+static unsigned int nulink_usb_mem32_words(struct nulink_usb_handle_s *h)
 {
-	int res = ERROR_OK;
-	uint32_t bytes_remaining = 12;
-	struct nulink_usb_handle_s *h = handle;
+	unsigned int words;
 
-	assert(handle);
+	if (h->hardwareConfig & HARDWARE_CONFIG_NULINK2)
+		words = (h->max_packet_size - 3 - 8) / 12;
+	else
+		words = (h->max_packet_size - 2 - 8) / 12;
 
-	/* data must be a multiple of 4 and word aligned */
-	if (len % 4 || addr % 4) {
-		LOG_ERROR("Invalid data alignment");
-		return ERROR_TARGET_UNALIGNED_ACCESS;
-	}
+	/* Nu-Link2 sends the size little-endian but matches the reply size
+	 * big-endian; only sizes below 256 have been seen to work with that,
+	 * so both encodings keep the command and its reply within one byte */
+	return MIN(words, (0xFFu - 8) / 12);
+}
 
-	while (len) {
-		if (len < bytes_remaining)
-			bytes_remaining = len;
+/* Read (rbuf set) or write (wbuf set) len bytes of word aligned memory.
+ * Each report carries as many words as nulink_usb_mem32_words() allows and
+ * up to NULINK_MAX_PENDING reports are in flight. */
+static int nulink_usb_xfer_mem32(void *handle, uint32_t addr, uint16_t len,
+		uint8_t *rbuf, const uint8_t *wbuf)
+{
+	struct nulink_usb_handle_s *h = handle;
+	const unsigned int max_words = nulink_usb_mem32_words(h);
+	uint8_t seq[NULINK_MAX_PENDING];
+	unsigned int words[NULINK_MAX_PENDING];
+	unsigned int head = 0, pending = 0;
+	int res = ERROR_OK;
 
-		unsigned int count = bytes_remaining / 4;
+#if defined(_WIN32) && (NUVOTON_CUSTOMIZED)
+	jtag_libusb_nuvoton_mutex_lock();
+#endif
 
-		m_nulink_usb_api.nulink_usb_init_buffer(handle, 8 + 12 * count);
-		/* set command ID */
-		h_u32_to_le(h->cmdbuf + h->cmdidx, CMD_WRITE_RAM);
-		h->cmdidx += 4;
-		/* Count of registers */
-		h->cmdbuf[h->cmdidx] = count;
-		h->cmdidx += 1;
-		/* Array of bool value (u8ReadOld) */
-		h->cmdbuf[h->cmdidx] = 0xFF;
-		h->cmdidx += 1;
-		/* Array of bool value (u8Verify) */
-		h->cmdbuf[h->cmdidx] = 0x00;
-		h->cmdidx += 1;
-		/* ignore */
-		h->cmdbuf[h->cmdidx] = 0;
-		h->cmdidx += 1;
+	while (len || pending) {
+		while (len && pending < NULINK_MAX_PENDING) {
+			unsigned int count = MIN(len / 4u, max_words);
 
-		for (unsigned int i = 0; i < count; i++) {
-			/* u32Addr */
-			h_u32_to_le(h->cmdbuf + h->cmdidx, addr);
+			m_nulink_usb_api.nulink_usb_init_buffer(handle, 8 + 12 * count);
+			/* set command ID */
+			h_u32_to_le(h->cmdbuf + h->cmdidx, CMD_WRITE_RAM);
 			h->cmdidx += 4;
-			/* u32Data */
-			h_u32_to_le(h->cmdbuf + h->cmdidx, 0);
-			h->cmdidx += 4;
-			/* u32Mask */
-			h_u32_to_le(h->cmdbuf + h->cmdidx, 0xFFFFFFFFUL);
-			h->cmdidx += 4;
-			/* proceed to the next one  */
-			addr += 4;
+			/* Count of registers */
+			h->cmdbuf[h->cmdidx] = count;
+			h->cmdidx += 1;
+			/* Array of bool value (u8ReadOld) */
+			h->cmdbuf[h->cmdidx] = rbuf ? 0xFF : 0x00;
+			h->cmdidx += 1;
+			/* Array of bool value (u8Verify) */
+			h->cmdbuf[h->cmdidx] = 0x00;
+			h->cmdidx += 1;
+			/* ignore */
+			h->cmdbuf[h->cmdidx] = 0;
+			h->cmdidx += 1;
+
+			for (unsigned int i = 0; i < count; i++) {
+				/* u32Addr */
+				h_u32_to_le(h->cmdbuf + h->cmdidx, addr);
+				h->cmdidx += 4;
+				/* u32Data */
+				h_u32_to_le(h->cmdbuf + h->cmdidx, wbuf ? buf_get_u32(wbuf, 0, 32) : 0);
+				h->cmdidx += 4;
+				/* u32Mask */
+				h_u32_to_le(h->cmdbuf + h->cmdidx, rbuf ? 0xFFFFFFFFUL : 0x00000000UL);
+				h->cmdidx += 4;
+				/* proceed to the next one */
+				addr += 4;
+				if (wbuf)
+					wbuf += 4;
+			}
+
+			res = nulink_usb_send(handle);
+			if (res != ERROR_OK)
+				goto out;
+
+			unsigned int slot = (head + pending) % NULINK_MAX_PENDING;
+			seq[slot] = h->cmdbuf[0];
+			words[slot] = count;
+			pending++;
+			len -= 4 * count;
 		}
 
-		res = m_nulink_usb_api.nulink_usb_xfer(handle, h->databuf, 4 * count * 2);
+		/* collect the reply to the oldest report */
+		res = m_nulink_usb_api.nulink_usb_recv(handle, seq[head], 4 * words[head] * 2, h->databuf);
+		if (res != ERROR_OK)
+			goto out;
 
-		/* fill in the output buffer */
-		for (unsigned int i = 0; i < count; i++) {
-			memcpy(buffer, h->databuf + 4 * (2 * i + 1), 4);
-			buffer += 4;
+		if (rbuf) {
+			/* fill in the output buffer */
+			for (unsigned int i = 0; i < words[head]; i++) {
+				memcpy(rbuf, h->databuf + 4 * (2 * i + 1), 4);
+				rbuf += 4;
+			}
 		}
 
-		if (len >= bytes_remaining)
-			len -= bytes_remaining;
-		else
-			len = 0;
+		head = (head + 1) % NULINK_MAX_PENDING;
+		pending--;
 	}
 
+out:
+#if defined(_WIN32) && (NUVOTON_CUSTOMIZED)
+	jtag_libusb_nuvoton_mutex_unlock();
+#endif
 	return res;
 }
 
-static int nulink_usb_write_mem32(void *handle, uint32_t addr, uint16_t len,
-		const uint8_t *buffer)
+static int nulink_usb_read_mem32(void *handle, uint32_t addr, uint16_t len,
+		uint8_t *buffer)
 {
-	int res = ERROR_OK;
-	uint32_t bytes_remaining = 12;
-	struct nulink_usb_handle_s *h = handle;
-
 	assert(handle);
 
 	/* data must be a multiple of 4 and word aligned */
@@ -1104,55 +1191,21 @@ static int nulink_usb_write_mem32(void *handle, uint32_t addr, uint16_t len,
 		return ERROR_TARGET_UNALIGNED_ACCESS;
 	}
 
-	while (len) {
-		if (len < bytes_remaining)
-			bytes_remaining = len;
-
-		unsigned int count = bytes_remaining / 4;
-
-		m_nulink_usb_api.nulink_usb_init_buffer(handle, 8 + 12 * count);
-		/* set command ID */
-		h_u32_to_le(h->cmdbuf + h->cmdidx, CMD_WRITE_RAM);
-		h->cmdidx += 4;
-		/* Count of registers */
-		h->cmdbuf[h->cmdidx] = count;
-		h->cmdidx += 1;
-		/* Array of bool value (u8ReadOld) */
-		h->cmdbuf[h->cmdidx] = 0x00;
-		h->cmdidx += 1;
-		/* Array of bool value (u8Verify) */
-		h->cmdbuf[h->cmdidx] = 0x00;
-		h->cmdidx += 1;
-		/* ignore */
-		h->cmdbuf[h->cmdidx] = 0;
-		h->cmdidx += 1;
-
-		for (unsigned int i = 0; i < count; i++) {
-			/* u32Addr */
-			h_u32_to_le(h->cmdbuf + h->cmdidx, addr);
-			h->cmdidx += 4;
-			/* u32Data */
-			uint32_t u32buffer = buf_get_u32(buffer, 0, 32);
-			h_u32_to_le(h->cmdbuf + h->cmdidx, u32buffer);
-			h->cmdidx += 4;
-			/* u32Mask */
-			h_u32_to_le(h->cmdbuf + h->cmdidx, 0x00000000UL);
-			h->cmdidx += 4;
-
-			/* proceed to the next one */
-			addr += 4;
-			buffer += 4;
-		}
+	return nulink_usb_xfer_mem32(handle, addr, len, buffer, NULL);
+}
 
-		res =  m_nulink_usb_api.nulink_usb_xfer(handle, h->databuf, 4 * count * 2);
+static int nulink_usb_write_mem32(void *handle, uint32_t addr, uint16_t len,
+		const uint8_t *buffer)
+{
+	assert(handle);
 
-		if (len >= bytes_remaining)
-			len -= bytes_remaining;
-		else
-			len = 0;
+	/* data must be a multiple of 4 and word aligned */
+	if (len % 4 || addr % 4) {
+		LOG_ERROR("Invalid data alignment");
+		return ERROR_TARGET_UNALIGNED_ACCESS;
 	}
 
-	return res;
+	return nulink_usb_xfer_mem32(handle, addr, len, NULL, buffer);
 }
 
 static uint32_t nulink_max_block_size(uint32_t tar_autoincr_block, uint32_t address)
@@ -1536,6 +1589,7 @@ static int nulink_usb_open(struct hl_interface_param_s *param, void **fd)
 		h->hardwareConfig |= HARDWARE_CONFIG_NULINK2;
 		m_nulink_usb_api.nulink_usb_xfer = nulink2_usb_xfer;
 		m_nulink_usb_api.nulink_usb_init_buffer = nulink2_usb_init_buffer;
+		m_nulink_usb_api.nulink_usb_recv = nulink2_usb_recv;
 		h->interface_num = NULINK2_INTERFACE_NUM;
 		h->max_packet_size = jtag_libusb_get_maxPacketSize(h->fd, 0, h->interface_num, &h->rx_ep, &h->tx_ep);
 		if (h->max_packet_size == (uint16_t)-1) {
@@ -1551,6 +1605,7 @@ static int nulink_usb_open(struct hl_interface_param_s *param, void **fd)
 
 		m_nulink_usb_api.nulink_usb_xfer = nulink1_usb_xfer;
 		m_nulink_usb_api.nulink_usb_init_buffer = nulink1_usb_init_buffer;
+		m_nulink_usb_api.nulink_usb_recv = nulink1_usb_recv;
 		h->interface_num = NULINK_INTERFACE_NUM;
 
 		h->max_packet_size = jtag_libusb_get_maxPacketSize(h->fd, 0, h->interface_num, &h->rx_ep, &h->tx_ep);
@@ -859,6 +859,31 @@ COMMAND_HANDLER(handle_jtag_init_command)
 	return jtag_init(CMD_CTX);
 }
 
+COMMAND_HANDLER(handle_jtag_queue_stats_command)
+{
+	struct cmd_queue_stats stats;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "reset") != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		cmd_queue_reset_stats();
+		return ERROR_OK;
+	}
+
+	cmd_queue_get_stats(&stats);
+	command_print(CMD, "bytes queued    %" PRIu64, stats.bytes_queued);
+	command_print(CMD, "flushes         %" PRIu64, stats.flushes);
+	command_print(CMD, "pages held      %u (%u in use, %u free)",
+			stats.pages_in_use + stats.pages_free, stats.pages_in_use, stats.pages_free);
+	command_print(CMD, "pages allocated %" PRIu64 ", reused %" PRIu64 ", freed %" PRIu64,
+			stats.pages_allocated, stats.pages_reused, stats.pages_freed);
+
+	return ERROR_OK;
+}
+
 static const struct command_registration jtag_subcommand_handlers[] = {
 	{
 		.name = "init",
@@ -942,6 +967,13 @@ static const struct command_registration jtag_subcommand_handlers[] = {
 		.jim_handler = jim_jtag_names,
 		.help = "Returns list of all JTAG tap names.",
 	},
+	{
+		.name = "queue_stats",
+		.mode = COMMAND_ANY,
+		.handler = handle_jtag_queue_stats_command,
+		.help = "show or reset the command queue allocator counters",
+		.usage = "['reset']",
+	},
 	{
 		.chain = jtag_command_handlers_to_move,
 	},
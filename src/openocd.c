@@ -38,6 +38,7 @@
 #include <target/arm_cti.h>
 #include <target/arm_adi_v5.h>
 #include <target/arm_tpiu_swo.h>
+#include <target/image.h>
 #include <rtt/rtt.h>
 
 #include <server/server.h>
@@ -416,6 +417,7 @@ int openocd_main(int argc, char *argv[])
 	ret = openocd_thread(argc, argv, cmd_ctx);
 
 	flash_free_all_banks();
+	image_free_cache();
 	gdb_service_free();
 	arm_tpiu_swo_cleanup_all();
 	server_free();
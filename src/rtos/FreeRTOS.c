@@ -98,8 +98,33 @@ static const struct freertos_params freertos_params_list[] = {
 	},
 };
 
+/* Upper bound of the data read per list item in one go. With the usual TCB
+ * layout (xStateListItem right after pxTopOfStack) this also covers the
+ * start of pcTaskName, so most names come for free with the list item. */
+#define FREERTOS_LIST_ITEM_READ_SIZE	80
+#define FREERTOS_THREAD_NAME_STR_SIZE	200
+
+struct freertos_task {
+	uint32_t tcb;
+	char *name;
+};
+
+struct freertos {
+	const struct freertos_params *param;
+	/* tasks found by the last full walk of the task lists */
+	struct freertos_task *tasks;
+	unsigned int num_tasks;
+	bool tasks_valid;
+	/* uxTaskNumber and uxCurrentNumberOfTasks at the time of that walk */
+	uint32_t task_number;
+	uint32_t number_of_tasks;
+	/* fingerprint of the symbol addresses used for that walk */
+	uint64_t symbols_hash;
+};
+
 static bool freertos_detect_rtos(struct target *target);
 static int freertos_create(struct target *target);
+static void freertos_destroy(struct rtos *rtos);
 static int freertos_update_threads(struct rtos *rtos);
 static int freertos_get_thread_reg_list(struct rtos *rtos, int64_t thread_id,
 		struct rtos_reg **reg_list, int *num_regs);
@@ -110,6 +135,7 @@ struct rtos_type freertos_rtos = {
 
 	.detect_rtos = freertos_detect_rtos,
 	.create = freertos_create,
+	.destroy = freertos_destroy,
 	.update_threads = freertos_update_threads,
 	.get_thread_reg_list = freertos_get_thread_reg_list,
 	.get_symbol_list_to_lookup = freertos_get_symbol_list_to_lookup,
@@ -127,6 +153,7 @@ enum freertos_symbol_values {
 	FREERTOS_VAL_X_SUSPENDED_TASK_LIST = 8,
 	FREERTOS_VAL_UX_CURRENT_NUMBER_OF_TASKS = 9,
 	FREERTOS_VAL_UX_TOP_USED_PRIORITY = 10,
+	FREERTOS_VAL_UX_TASK_NUMBER = 11,
 };
 
 struct symbols {
@@ -146,6 +173,7 @@ static const struct symbols freertos_symbol_list[] = {
 	{ "xSuspendedTaskList", true }, /* Only if INCLUDE_vTaskSuspend */
 	{ "uxCurrentNumberOfTasks", false },
 	{ "uxTopUsedPriority", true }, /* Unavailable since v7.5.3 */
+	{ "uxTaskNumber", true }, /* Bumped on every task creation and deletion */
 	{ NULL, false }
 };
 
@@ -154,16 +182,213 @@ static const struct symbols freertos_symbol_list[] = {
 /* may be problems reading if sizes are not 32 bit long integers. */
 /* test mallocs for failure */
 
+static void freertos_free_tasks(struct freertos_task *tasks, unsigned int num_tasks)
+{
+	for (unsigned int i = 0; i < num_tasks; i++)
+		free(tasks[i].name);
+	free(tasks);
+}
+
+static const char *freertos_cached_name(const struct freertos *freertos, uint32_t tcb)
+{
+	for (unsigned int i = 0; i < freertos->num_tasks; i++)
+		if (freertos->tasks[i].tcb == tcb)
+			return freertos->tasks[i].name;
+	return NULL;
+}
+
+/* Get the name of the task with TCB at 'tcb'. 'item' holds 'item_len' bytes
+ * read from 'item_addr'; the name is taken from there when it lies entirely
+ * within, otherwise from the cache of the previous walk if 'use_cache' or
+ * from the target. */
+static char *freertos_task_name(struct rtos *rtos, const struct freertos *freertos,
+		uint32_t tcb, uint32_t item_addr, const uint8_t *item, uint32_t item_len,
+		bool use_cache)
+{
+	uint32_t name_addr = tcb + freertos->param->thread_name_offset;
+	uint32_t offset = name_addr - item_addr;
+	char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
+
+	if (name_addr >= item_addr && offset < item_len &&
+			memchr(item + offset, '\x00', item_len - offset)) {
+		strcpy(tmp_str, (const char *)item + offset);
+	} else {
+		const char *cached = use_cache ? freertos_cached_name(freertos, tcb) : NULL;
+		if (cached)
+			return strdup(cached);
+
+		/* Read the thread name */
+		int retval = target_read_buffer(rtos->target, name_addr,
+				FREERTOS_THREAD_NAME_STR_SIZE, (uint8_t *)&tmp_str);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Error reading thread name in FreeRTOS thread list");
+			return NULL;
+		}
+		tmp_str[FREERTOS_THREAD_NAME_STR_SIZE-1] = '\x00';
+	}
+	LOG_DEBUG("FreeRTOS: Read Thread Name at 0x%" PRIx32 ", value '%s'",
+										name_addr, tmp_str);
+
+	if (tmp_str[0] == '\x00')
+		strcpy(tmp_str, "No Name");
+
+	return strdup(tmp_str);
+}
+
+/* Walk all task lists and collect at most 'max_tasks' tasks in 'tasks'. */
+static int freertos_read_tasks(struct rtos *rtos, const struct freertos *freertos,
+		uint32_t max_tasks, bool use_cache, struct freertos_task *tasks,
+		unsigned int *num_tasks)
+{
+	const struct freertos_params *param = freertos->param;
+	int retval;
+
+	*num_tasks = 0;
+
+	/* Find out how many lists are needed to be read from pxReadyTasksLists, */
+	if (rtos->symbols[FREERTOS_VAL_UX_TOP_USED_PRIORITY].address == 0) {
+		LOG_ERROR("FreeRTOS: uxTopUsedPriority is not defined, consult the OpenOCD manual for a work-around");
+		return ERROR_FAIL;
+	}
+	uint32_t top_used_priority = 0;
+	retval = target_read_u32(rtos->target,
+			rtos->symbols[FREERTOS_VAL_UX_TOP_USED_PRIORITY].address,
+			&top_used_priority);
+	if (retval != ERROR_OK)
+		return retval;
+	LOG_DEBUG("FreeRTOS: Read uxTopUsedPriority at 0x%" PRIx64 ", value %" PRIu32,
+										rtos->symbols[FREERTOS_VAL_UX_TOP_USED_PRIORITY].address,
+										top_used_priority);
+	if (top_used_priority > FREERTOS_MAX_PRIORITIES) {
+		LOG_ERROR("FreeRTOS top used priority is unreasonably big, not proceeding: %" PRIu32,
+			top_used_priority);
+		return ERROR_FAIL;
+	}
+
+	/* uxTopUsedPriority was defined as configMAX_PRIORITIES - 1
+	 * in old FreeRTOS versions (before V7.5.3)
+	 * Use contrib/rtos-helpers/FreeRTOS-openocd.c to get compatible symbol
+	 * in newer FreeRTOS versions.
+	 * Here we restore the original configMAX_PRIORITIES value */
+	unsigned int config_max_priorities = top_used_priority + 1;
+
+	symbol_address_t *list_of_lists =
+		malloc(sizeof(symbol_address_t) * (config_max_priorities + 5));
+	uint8_t *list_headers = malloc((config_max_priorities + 5) * param->list_width);
+	if (!list_of_lists || !list_headers) {
+		LOG_ERROR("Error allocating memory for %u priorities", config_max_priorities);
+		free(list_of_lists);
+		free(list_headers);
+		return ERROR_FAIL;
+	}
+
+	unsigned int num_lists;
+	for (num_lists = 0; num_lists < config_max_priorities; num_lists++)
+		list_of_lists[num_lists] = rtos->symbols[FREERTOS_VAL_PX_READY_TASKS_LISTS].address +
+			num_lists * param->list_width;
+
+	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_DELAYED_TASK_LIST1].address;
+	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_DELAYED_TASK_LIST2].address;
+	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_PENDING_READY_LIST].address;
+	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_SUSPENDED_TASK_LIST].address;
+	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_TASKS_WAITING_TERMINATION].address;
+
+	/* The ready lists are one contiguous array, fetch all their headers at once */
+	retval = target_read_buffer(rtos->target, list_of_lists[0],
+			config_max_priorities * param->list_width, list_headers);
+	for (unsigned int i = config_max_priorities; retval == ERROR_OK && i < num_lists; i++) {
+		if (list_of_lists[i] == 0)
+			continue;
+		retval = target_read_buffer(rtos->target, list_of_lists[i], param->list_width,
+				list_headers + i * param->list_width);
+	}
+	if (retval != ERROR_OK) {
+		LOG_ERROR("Error reading FreeRTOS thread list headers");
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < num_lists; i++) {
+		if (list_of_lists[i] == 0)
+			continue;
+
+		const uint8_t *header = list_headers + i * param->list_width;
+
+		/* The number of threads in this list */
+		uint32_t list_thread_count = target_buffer_get_u32(rtos->target, header);
+		LOG_DEBUG("FreeRTOS: Read thread count for list %u at 0x%" PRIx64 ", value %" PRIu32,
+										i, list_of_lists[i], list_thread_count);
+
+		if (list_thread_count == 0)
+			continue;
+
+		/* The location of first list item */
+		uint32_t prev_list_elem_ptr = -1;
+		uint32_t list_elem_ptr = target_buffer_get_u32(rtos->target,
+				header + param->list_next_offset);
+		LOG_DEBUG("FreeRTOS: Read first item for list %u at 0x%" PRIx64 ", value 0x%" PRIx32,
+										i, list_of_lists[i] + param->list_next_offset, list_elem_ptr);
+
+		while ((list_thread_count > 0) && (list_elem_ptr != 0) &&
+				(list_elem_ptr != prev_list_elem_ptr) &&
+				(*num_tasks < max_tasks)) {
+			/* Fetch the list item together with whatever follows it */
+			uint8_t item[FREERTOS_LIST_ITEM_READ_SIZE];
+			uint32_t item_len = sizeof(item);
+			retval = target_read_buffer(rtos->target, list_elem_ptr, item_len, item);
+			if (retval != ERROR_OK) {
+				/* May run past the end of memory, retry with the item alone */
+				item_len = MAX(param->list_elem_next_offset,
+						param->list_elem_content_offset) + param->pointer_width;
+				retval = target_read_buffer(rtos->target, list_elem_ptr, item_len, item);
+			}
+			if (retval != ERROR_OK) {
+				LOG_ERROR("Error reading thread list item in FreeRTOS thread list");
+				goto out;
+			}
+
+			/* Get the location of the thread structure. */
+			uint32_t tcb = target_buffer_get_u32(rtos->target,
+					item + param->list_elem_content_offset);
+			LOG_DEBUG("FreeRTOS: Read Thread ID at 0x%" PRIx32 ", value 0x%" PRIx32,
+										list_elem_ptr + param->list_elem_content_offset,
+										tcb);
+
+			char *name = freertos_task_name(rtos, freertos, tcb, list_elem_ptr,
+					item, item_len, use_cache);
+			if (!name) {
+				retval = ERROR_FAIL;
+				goto out;
+			}
+			tasks[*num_tasks].tcb = tcb;
+			tasks[*num_tasks].name = name;
+			(*num_tasks)++;
+			list_thread_count--;
+
+			prev_list_elem_ptr = list_elem_ptr;
+			list_elem_ptr = target_buffer_get_u32(rtos->target,
+					item + param->list_elem_next_offset);
+			LOG_DEBUG("FreeRTOS: Read next thread location at 0x%" PRIx32 ", value 0x%" PRIx32,
+										prev_list_elem_ptr + param->list_elem_next_offset,
+										list_elem_ptr);
+		}
+	}
+
+out:
+	free(list_headers);
+	free(list_of_lists);
+	return retval;
+}
+
 static int freertos_update_threads(struct rtos *rtos)
 {
 	int retval;
 	unsigned int tasks_found = 0;
-	const struct freertos_params *param;
+	struct freertos *freertos;
 
 	if (!rtos->rtos_specific_params)
 		return -1;
 
-	param = (const struct freertos_params *) rtos->rtos_specific_params;
+	freertos = (struct freertos *) rtos->rtos_specific_params;
 
 	if (!rtos->symbols) {
 		LOG_ERROR("No symbols for FreeRTOS");
@@ -205,6 +430,35 @@ static int freertos_update_threads(struct rtos *rtos)
 										rtos->symbols[FREERTOS_VAL_PX_CURRENT_TCB].address,
 										rtos->current_thread);
 
+	/* uxTaskNumber changes whenever a task is created or deleted. As long as
+	 * it does not, the task set of the previous walk is still accurate. */
+	bool have_task_number = rtos->symbols[FREERTOS_VAL_UX_TASK_NUMBER].address != 0;
+	uint32_t task_number = 0;
+	if (have_task_number) {
+		retval = target_read_u32(rtos->target,
+				rtos->symbols[FREERTOS_VAL_UX_TASK_NUMBER].address,
+				&task_number);
+		if (retval != ERROR_OK) {
+			LOG_ERROR("Error reading uxTaskNumber in FreeRTOS");
+			return retval;
+		}
+		LOG_DEBUG("FreeRTOS: Read uxTaskNumber at 0x%" PRIx64 ", value %" PRIu32,
+										rtos->symbols[FREERTOS_VAL_UX_TASK_NUMBER].address,
+										task_number);
+	}
+
+	/* a new symbol lookup (GDB loaded another image) may have moved the lists */
+	uint64_t symbols_hash = 0;
+	for (struct symbol_table_elem *s = rtos->symbols; s->symbol_name; s++)
+		symbols_hash = (symbols_hash ^ s->address) * 0x100000001b3ULL;
+	if (symbols_hash != freertos->symbols_hash) {
+		freertos->tasks_valid = false;
+		freertos->symbols_hash = symbols_hash;
+	}
+
+	bool same_tasks = have_task_number && freertos->tasks_valid &&
+		task_number == freertos->task_number;
+
 	if ((thread_list_size  == 0) || (rtos->current_thread == 0)) {
 		/* Either : No RTOS threads - there is always at least the current execution though */
 		/* OR     : No current thread - all threads suspended - show the current execution
@@ -237,161 +491,53 @@ static int freertos_update_threads(struct rtos *rtos)
 			return ERROR_FAIL;
 		}
 	}
-
-	/* Find out how many lists are needed to be read from pxReadyTasksLists, */
-	if (rtos->symbols[FREERTOS_VAL_UX_TOP_USED_PRIORITY].address == 0) {
-		LOG_ERROR("FreeRTOS: uxTopUsedPriority is not defined, consult the OpenOCD manual for a work-around");
-		return ERROR_FAIL;
-	}
-	uint32_t top_used_priority = 0;
-	retval = target_read_u32(rtos->target,
-			rtos->symbols[FREERTOS_VAL_UX_TOP_USED_PRIORITY].address,
-			&top_used_priority);
-	if (retval != ERROR_OK)
-		return retval;
-	LOG_DEBUG("FreeRTOS: Read uxTopUsedPriority at 0x%" PRIx64 ", value %" PRIu32,
-										rtos->symbols[FREERTOS_VAL_UX_TOP_USED_PRIORITY].address,
-										top_used_priority);
-	if (top_used_priority > FREERTOS_MAX_PRIORITIES) {
-		LOG_ERROR("FreeRTOS top used priority is unreasonably big, not proceeding: %" PRIu32,
-			top_used_priority);
-		return ERROR_FAIL;
-	}
-
-	/* uxTopUsedPriority was defined as configMAX_PRIORITIES - 1
-	 * in old FreeRTOS versions (before V7.5.3)
-	 * Use contrib/rtos-helpers/FreeRTOS-openocd.c to get compatible symbol
-	 * in newer FreeRTOS versions.
-	 * Here we restore the original configMAX_PRIORITIES value */
-	unsigned int config_max_priorities = top_used_priority + 1;
-
-	symbol_address_t *list_of_lists =
-		malloc(sizeof(symbol_address_t) * (config_max_priorities + 5));
-	if (!list_of_lists) {
-		LOG_ERROR("Error allocating memory for %u priorities", config_max_priorities);
-		return ERROR_FAIL;
-	}
-
-	unsigned int num_lists;
-	for (num_lists = 0; num_lists < config_max_priorities; num_lists++)
-		list_of_lists[num_lists] = rtos->symbols[FREERTOS_VAL_PX_READY_TASKS_LISTS].address +
-			num_lists * param->list_width;
-
-	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_DELAYED_TASK_LIST1].address;
-	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_DELAYED_TASK_LIST2].address;
-	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_PENDING_READY_LIST].address;
-	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_SUSPENDED_TASK_LIST].address;
-	list_of_lists[num_lists++] = rtos->symbols[FREERTOS_VAL_X_TASKS_WAITING_TERMINATION].address;
-
-	for (unsigned int i = 0; i < num_lists; i++) {
-		if (list_of_lists[i] == 0)
-			continue;
-
-		/* Read the number of threads in this list */
-		uint32_t list_thread_count = 0;
-		retval = target_read_u32(rtos->target,
-				list_of_lists[i],
-				&list_thread_count);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("Error reading number of threads in FreeRTOS thread list");
-			free(list_of_lists);
-			return retval;
+	/* tasks_found is 1 iff the pseudo thread was added above */
+	uint32_t max_tasks = thread_list_size - tasks_found;
+
+	if (!same_tasks || max_tasks != freertos->number_of_tasks) {
+		struct freertos_task *tasks = calloc(max_tasks, sizeof(*tasks));
+		unsigned int num_tasks = 0;
+		if (!tasks) {
+			LOG_ERROR("Error allocating memory for %" PRIu32 " threads", max_tasks);
+			rtos->thread_count = tasks_found;
+			return ERROR_FAIL;
 		}
-		LOG_DEBUG("FreeRTOS: Read thread count for list %u at 0x%" PRIx64 ", value %" PRIu32,
-										i, list_of_lists[i], list_thread_count);
-
-		if (list_thread_count == 0)
-			continue;
 
-		/* Read the location of first list item */
-		uint32_t prev_list_elem_ptr = -1;
-		uint32_t list_elem_ptr = 0;
-		retval = target_read_u32(rtos->target,
-				list_of_lists[i] + param->list_next_offset,
-				&list_elem_ptr);
+		/* Names of TCBs seen before can only be reused if no task has been
+		 * created since, otherwise a new TCB may sit at a freed address. */
+		retval = freertos_read_tasks(rtos, freertos, max_tasks, same_tasks,
+				tasks, &num_tasks);
+		freertos_free_tasks(freertos->tasks, freertos->num_tasks);
+		freertos->tasks = tasks;
+		freertos->num_tasks = num_tasks;
+		freertos->tasks_valid = retval == ERROR_OK;
+		freertos->task_number = task_number;
+		freertos->number_of_tasks = max_tasks;
 		if (retval != ERROR_OK) {
-			LOG_ERROR("Error reading first thread item location in FreeRTOS thread list");
-			free(list_of_lists);
+			rtos->thread_count = tasks_found;
 			return retval;
 		}
-		LOG_DEBUG("FreeRTOS: Read first item for list %u at 0x%" PRIx64 ", value 0x%" PRIx32,
-										i, list_of_lists[i] + param->list_next_offset, list_elem_ptr);
-
-		while ((list_thread_count > 0) && (list_elem_ptr != 0) &&
-				(list_elem_ptr != prev_list_elem_ptr) &&
-				(tasks_found < thread_list_size)) {
-			/* Get the location of the thread structure. */
-			rtos->thread_details[tasks_found].threadid = 0;
-			retval = target_read_u32(rtos->target,
-					list_elem_ptr + param->list_elem_content_offset,
-					&pointer_casts_are_bad);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading thread list item object in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-			rtos->thread_details[tasks_found].threadid = pointer_casts_are_bad;
-			LOG_DEBUG("FreeRTOS: Read Thread ID at 0x%" PRIx32 ", value 0x%" PRIx64,
-										list_elem_ptr + param->list_elem_content_offset,
-										rtos->thread_details[tasks_found].threadid);
+	} else {
+		LOG_DEBUG("FreeRTOS: Task set unchanged, reusing %u threads", freertos->num_tasks);
+	}
 
-			/* get thread name */
+	for (unsigned int i = 0; i < freertos->num_tasks; i++) {
+		struct thread_detail *detail = &rtos->thread_details[tasks_found];
 
-			#define FREERTOS_THREAD_NAME_STR_SIZE (200)
-			char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
+		detail->threadid = freertos->tasks[i].tcb;
+		detail->thread_name_str = strdup(freertos->tasks[i].name);
+		detail->exists = true;
 
-			/* Read the thread name */
-			retval = target_read_buffer(rtos->target,
-					rtos->thread_details[tasks_found].threadid + param->thread_name_offset,
-					FREERTOS_THREAD_NAME_STR_SIZE,
-					(uint8_t *)&tmp_str);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading first thread item location in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-			tmp_str[FREERTOS_THREAD_NAME_STR_SIZE-1] = '\x00';
-			LOG_DEBUG("FreeRTOS: Read Thread Name at 0x%" PRIx64 ", value '%s'",
-										rtos->thread_details[tasks_found].threadid + param->thread_name_offset,
-										tmp_str);
-
-			if (tmp_str[0] == '\x00')
-				strcpy(tmp_str, "No Name");
-
-			rtos->thread_details[tasks_found].thread_name_str =
-				malloc(strlen(tmp_str)+1);
-			strcpy(rtos->thread_details[tasks_found].thread_name_str, tmp_str);
-			rtos->thread_details[tasks_found].exists = true;
-
-			if (rtos->thread_details[tasks_found].threadid == rtos->current_thread) {
-				char running_str[] = "State: Running";
-				rtos->thread_details[tasks_found].extra_info_str = malloc(
-						sizeof(running_str));
-				strcpy(rtos->thread_details[tasks_found].extra_info_str,
-					running_str);
-			} else
-				rtos->thread_details[tasks_found].extra_info_str = NULL;
-
-			tasks_found++;
-			list_thread_count--;
+		if (detail->threadid == rtos->current_thread) {
+			char running_str[] = "State: Running";
+			detail->extra_info_str = malloc(sizeof(running_str));
+			strcpy(detail->extra_info_str, running_str);
+		} else
+			detail->extra_info_str = NULL;
 
-			prev_list_elem_ptr = list_elem_ptr;
-			list_elem_ptr = 0;
-			retval = target_read_u32(rtos->target,
-					prev_list_elem_ptr + param->list_elem_next_offset,
-					&list_elem_ptr);
-			if (retval != ERROR_OK) {
-				LOG_ERROR("Error reading next thread item location in FreeRTOS thread list");
-				free(list_of_lists);
-				return retval;
-			}
-			LOG_DEBUG("FreeRTOS: Read next thread location at 0x%" PRIx32 ", value 0x%" PRIx32,
-										prev_list_elem_ptr + param->list_elem_next_offset,
-										list_elem_ptr);
-		}
+		tasks_found++;
 	}
 
-	free(list_of_lists);
 	rtos->thread_count = tasks_found;
 	return 0;
 }
@@ -412,7 +558,7 @@ static int freertos_get_thread_reg_list(struct rtos *rtos, int64_t thread_id,
 	if (!rtos->rtos_specific_params)
 		return -1;
 
-	param = (const struct freertos_params *) rtos->rtos_specific_params;
+	param = ((struct freertos *) rtos->rtos_specific_params)->param;
 
 	/* Read the stack pointer */
 	uint32_t pointer_casts_are_bad;
@@ -503,9 +649,8 @@ static int freertos_get_thread_ascii_info(struct rtos *rtos, threadid_t thread_i
 	if (!rtos->rtos_specific_params)
 		return -3;
 
-	param = (const struct freertos_params *) rtos->rtos_specific_params;
+	param = ((struct freertos *) rtos->rtos_specific_params)->param;
 
-#define FREERTOS_THREAD_NAME_STR_SIZE (200)
 	char tmp_str[FREERTOS_THREAD_NAME_STR_SIZE];
 
 	/* Read the thread name */
@@ -539,14 +684,62 @@ static bool freertos_detect_rtos(struct target *target)
 	return false;
 }
 
+/* A reset or a flash write from GDB may bring up a different image that
+ * happens to create the same number of tasks: walk the lists again. */
+static int freertos_reset_handler(struct target *target,
+		enum target_reset_mode reset_mode, void *priv)
+{
+	struct freertos *freertos = priv;
+
+	if (target->rtos && target->rtos->rtos_specific_params == freertos)
+		freertos->tasks_valid = false;
+
+	return ERROR_OK;
+}
+
+static int freertos_event_handler(struct target *target,
+		enum target_event event, void *priv)
+{
+	struct freertos *freertos = priv;
+
+	if ((event == TARGET_EVENT_GDB_FLASH_WRITE_END || event == TARGET_EVENT_GDB_ATTACH) &&
+			target->rtos && target->rtos->rtos_specific_params == freertos)
+		freertos->tasks_valid = false;
+
+	return ERROR_OK;
+}
+
 static int freertos_create(struct target *target)
 {
 	for (unsigned int i = 0; i < ARRAY_SIZE(freertos_params_list); i++)
 		if (strcmp(freertos_params_list[i].target_name, target->type->name) == 0) {
-			target->rtos->rtos_specific_params = (void *)&freertos_params_list[i];
+			struct freertos *freertos = calloc(1, sizeof(*freertos));
+			if (!freertos) {
+				LOG_ERROR("FreeRTOS: out of memory");
+				return ERROR_FAIL;
+			}
+			freertos->param = &freertos_params_list[i];
+			target->rtos->rtos_specific_params = freertos;
+
+			target_register_reset_callback(freertos_reset_handler, freertos);
+			target_register_event_callback(freertos_event_handler, freertos);
 			return 0;
 		}
 
 	LOG_ERROR("Could not find target in FreeRTOS compatibility list");
 	return -1;
 }
+
+static void freertos_destroy(struct rtos *rtos)
+{
+	struct freertos *freertos = rtos->rtos_specific_params;
+
+	if (!freertos)
+		return;
+
+	target_unregister_reset_callback(freertos_reset_handler, freertos);
+	target_unregister_event_callback(freertos_event_handler, freertos);
+	freertos_free_tasks(freertos->tasks, freertos->num_tasks);
+	free(freertos);
+	rtos->rtos_specific_params = NULL;
+}
@@ -104,6 +104,9 @@ static void os_free(struct target *target)
 	if (!target->rtos)
 		return;
 
+	if (target->rtos->type && target->rtos->type->destroy)
+		target->rtos->type->destroy(target->rtos);
+
 	free(target->rtos->symbols);
 	free(target->rtos);
 	target->rtos = NULL;
@@ -80,6 +80,8 @@ struct rtos_type {
 			uint32_t reg_num, struct rtos_reg *reg);
 	int (*get_symbol_list_to_lookup)(struct symbol_table_elem *symbol_list[]);
 	int (*clean)(struct target *target);
+	/** Release what create() allocated, optional. */
+	void (*destroy)(struct rtos *rtos);
 	char * (*ps_command)(struct target *target);
 	int (*set_reg)(struct rtos *rtos, uint32_t reg_num, uint8_t *reg_value);
 	/* Implement these if different threads in the RTOS can see memory
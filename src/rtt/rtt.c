@@ -53,7 +53,12 @@ static struct {
 	struct rtt_sink_list **sink_list;
 	size_t sink_list_length;
 
+	/** Polling interval in milliseconds. */
 	unsigned int polling_interval;
+	/** Maximum polling interval in milliseconds. */
+	unsigned int max_polling_interval;
+	/** Current polling interval in milliseconds. */
+	unsigned int current_polling_interval;
 } rtt;
 
 int rtt_init(void)
@@ -69,6 +74,7 @@ int rtt_init(void)
 	rtt.started = false;
 
 	rtt.polling_interval = 100;
+	rtt.max_polling_interval = 100;
 
 	return ERROR_OK;
 }
@@ -80,12 +86,23 @@ int rtt_exit(void)
 	return ERROR_OK;
 }
 
+static int read_channel_callback(void *user_data);
+
+static void schedule_read_channel(unsigned int interval)
+{
+	target_unregister_timer_callback(&read_channel_callback, NULL);
+	target_register_timer_callback(&read_channel_callback, interval, 1, NULL);
+	rtt.current_polling_interval = interval;
+}
+
 static int read_channel_callback(void *user_data)
 {
 	int ret;
+	size_t length;
+	unsigned int interval;
 
 	ret = rtt.source.read(rtt.target, &rtt.ctrl, rtt.sink_list,
-		rtt.sink_list_length, NULL);
+		rtt.sink_list_length, &length, NULL);
 
 	if (ret != ERROR_OK) {
 		target_unregister_timer_callback(&read_channel_callback, NULL);
@@ -93,6 +110,20 @@ static int read_channel_callback(void *user_data)
 		return ret;
 	}
 
+	/*
+	 * Poll at the configured interval while data is flowing and back off
+	 * exponentially towards the maximum interval while the channels are idle.
+	 */
+	if (length)
+		interval = rtt.polling_interval;
+	else if (rtt.current_polling_interval > rtt.max_polling_interval / 2)
+		interval = rtt.max_polling_interval;
+	else
+		interval = 2 * rtt.current_polling_interval;
+
+	if (interval != rtt.current_polling_interval)
+		schedule_read_channel(interval);
+
 	return ERROR_OK;
 }
 
@@ -166,8 +197,7 @@ int rtt_start(void)
 	if (ret != ERROR_OK)
 		return ret;
 
-	target_register_timer_callback(&read_channel_callback,
-		rtt.polling_interval, 1, NULL);
+	schedule_read_channel(rtt.polling_interval);
 	rtt.started = true;
 
 	return ERROR_OK;
@@ -270,28 +300,29 @@ int rtt_unregister_sink(unsigned int channel_index, rtt_sink_read read,
 	return ERROR_OK;
 }
 
-int rtt_get_polling_interval(unsigned int *interval)
+int rtt_get_polling_interval(unsigned int *interval,
+		unsigned int *max_interval)
 {
-	if (!interval)
+	if (!interval || !max_interval)
 		return ERROR_FAIL;
 
 	*interval = rtt.polling_interval;
+	*max_interval = rtt.max_polling_interval;
 
 	return ERROR_OK;
 }
 
-int rtt_set_polling_interval(unsigned int interval)
+int rtt_set_polling_interval(unsigned int interval,
+		unsigned int max_interval)
 {
-	if (!interval)
+	if (!interval || max_interval < interval)
 		return ERROR_FAIL;
 
-	if (rtt.polling_interval != interval) {
-		target_unregister_timer_callback(&read_channel_callback, NULL);
-		target_register_timer_callback(&read_channel_callback, interval, 1,
-			NULL);
-	}
-
 	rtt.polling_interval = interval;
+	rtt.max_polling_interval = max_interval;
+
+	if (rtt.started)
+		schedule_read_channel(interval);
 
 	return ERROR_OK;
 }
@@ -121,7 +121,7 @@ typedef int (*rtt_source_start)(struct target *target,
 typedef int (*rtt_source_stop)(struct target *target, void *user_data);
 typedef int (*rtt_source_read)(struct target *target,
 		const struct rtt_control *ctrl, struct rtt_sink_list **sinks,
-		size_t num_channels, void *user_data);
+		size_t num_channels, size_t *length, void *user_data);
 typedef int (*rtt_source_write)(struct target *target,
 		struct rtt_control *ctrl, unsigned int channel,
 		const uint8_t *buffer, size_t *length, void *user_data);
@@ -191,19 +191,28 @@ int rtt_stop(void);
  * Get the polling interval.
  *
  * @param[out] interval Polling interval in milliseconds.
+ * @param[out] max_interval Maximum polling interval in milliseconds.
  *
  * @returns ERROR_OK on success, an error code on failure.
  */
-int rtt_get_polling_interval(unsigned int *interval);
+int rtt_get_polling_interval(unsigned int *interval,
+		unsigned int *max_interval);
 
 /**
  * Set the polling interval.
  *
+ * If the maximum polling interval is larger than the polling interval, the
+ * interval is adapted to the data rate: it is doubled up to the maximum while
+ * the up-channels are idle and drops back to the polling interval as soon as
+ * data is received.
+ *
  * @param[in] interval Polling interval in milliseconds.
+ * @param[in] max_interval Maximum polling interval in milliseconds.
  *
  * @returns ERROR_OK on success, an error code on failure.
  */
-int rtt_set_polling_interval(unsigned int interval);
+int rtt_set_polling_interval(unsigned int interval,
+		unsigned int max_interval);
 
 /**
  * Get whether RTT is started.
@@ -81,21 +81,32 @@ COMMAND_HANDLER(handle_rtt_polling_interval_command)
 	if (CMD_ARGC == 0) {
 		int ret;
 		unsigned int interval;
+		unsigned int max_interval;
 
-		ret = rtt_get_polling_interval(&interval);
+		ret = rtt_get_polling_interval(&interval, &max_interval);
 
 		if (ret != ERROR_OK) {
 			command_print(CMD, "Failed to get polling interval");
 			return ret;
 		}
 
-		command_print(CMD, "%u ms", interval);
-	} else if (CMD_ARGC == 1) {
+		if (max_interval > interval)
+			command_print(CMD, "%u ms (adaptive up to %u ms)", interval,
+				max_interval);
+		else
+			command_print(CMD, "%u ms", interval);
+	} else if (CMD_ARGC <= 2) {
 		int ret;
 		unsigned int interval;
+		unsigned int max_interval;
 
 		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], interval);
-		ret = rtt_set_polling_interval(interval);
+		max_interval = interval;
+
+		if (CMD_ARGC == 2)
+			COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], max_interval);
+
+		ret = rtt_set_polling_interval(interval, max_interval);
 
 		if (ret != ERROR_OK) {
 			command_print(CMD, "Failed to set polling interval");
@@ -284,7 +295,7 @@ static const struct command_registration rtt_subcommand_handlers[] = {
 		.handler = handle_rtt_polling_interval_command,
 		.mode = COMMAND_EXEC,
 		.help = "show or set polling interval in ms",
-		.usage = "[interval]"
+		.usage = "[interval [max_interval]]"
 	},
 	{
 		.name = "channels",
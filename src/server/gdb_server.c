@@ -106,6 +106,9 @@ struct gdb_connection {
 	char *thread_list;
 	/* flag to mask the output from gdb_log_callback() */
 	enum gdb_output_flag output_flag;
+	/* arena used to assemble complete outgoing "$...#xx" frames */
+	char *out_buf;
+	size_t out_buf_size;
 };
 
 #if 0
@@ -151,6 +154,10 @@ static int gdb_report_register_access_error;
 /* enabled by default */
 static int gdb_use_target_description = 1;
 
+/* set if outgoing packets are run-length encoded */
+/* enabled by default */
+static int gdb_use_rle = 1;
+
 /* current processing free-run type, used by file-I/O */
 static char gdb_running_type;
 
@@ -418,17 +425,89 @@ static void gdb_log_outgoing_packet(struct connection *connection, char *packet_
 			checksum);
 }
 
+/* Assemble "$<payload>#xx" in the connection's output arena, run-length
+ * encoding the payload when enabled, so the whole frame can be sent with a
+ * single write.  Returns the frame length or -1 if out of memory. */
+static int gdb_frame_packet(struct gdb_connection *gdb_con,
+		const char *buffer, int len, unsigned char *checksum)
+{
+	/* '$', "#xx" and the terminating null written by snprintf(),
+	 * run-length encoding never makes the payload longer */
+	size_t needed = (size_t)len + 5;
+	if (needed > gdb_con->out_buf_size) {
+		char *out_buf = realloc(gdb_con->out_buf, needed);
+		if (!out_buf)
+			return -1;
+		gdb_con->out_buf = out_buf;
+		gdb_con->out_buf_size = needed;
+	}
+
+	char *out = gdb_con->out_buf;
+	unsigned char my_checksum = 0;
+	int n = 0;
+
+	out[n++] = '$';
+	for (int i = 0; i < len; ) {
+		char c = buffer[i];
+		int run = 1;
+
+		/* an escape and the byte it escapes form one token that is
+		 * copied as is, a run never starts on the escaped byte */
+		if (c == '}' && i + 1 < len) {
+			out[n++] = c;
+			out[n++] = buffer[i + 1];
+			my_checksum += c + buffer[i + 1];
+			i += 2;
+			continue;
+		}
+
+		/* '*' would be taken as a repeat marker, never encode runs of
+		 * the framing and escape characters themselves */
+		if (gdb_use_rle && c != '*' && c != '#' && c != '$' && c != '}') {
+			/* repeat counts are printable: ' ' + 3 .. '~' */
+			while (i + run < len && run < 98 && buffer[i + run] == c)
+				run++;
+		}
+
+		if (run >= 4) {
+			/* repeat counts of '#' and '$' are not allowed, emit only
+			 * 5 repeats and leave the remaining characters for the next run */
+			if (run == 7 || run == 8)
+				run = 6;
+			/* the character is repeated count - 29 more times */
+			char count = run - 1 + 29;
+			out[n++] = c;
+			out[n++] = '*';
+			out[n++] = count;
+			my_checksum += c + '*' + count;
+		} else {
+			for (int j = 0; j < run; j++) {
+				out[n++] = c;
+				my_checksum += c;
+			}
+		}
+		i += run;
+	}
+
+	n += snprintf(out + n, gdb_con->out_buf_size - n, "#%02x", my_checksum);
+	*checksum = my_checksum;
+
+	return n;
+}
+
 static int gdb_put_packet_inner(struct connection *connection,
 		char *buffer, int len)
 {
-	int i;
 	unsigned char my_checksum = 0;
 	int reply;
 	int retval;
 	struct gdb_connection *gdb_con = connection->priv;
 
-	for (i = 0; i < len; i++)
-		my_checksum += buffer[i];
+	int frame_len = gdb_frame_packet(gdb_con, buffer, len, &my_checksum);
+	if (frame_len < 0) {
+		LOG_ERROR("Out of memory framing gdb packet");
+		return ERROR_FAIL;
+	}
 
 #ifdef _DEBUG_GDB_IO_
 	/*
@@ -460,29 +539,10 @@ static int gdb_put_packet_inner(struct connection *connection,
 	while (1) {
 		gdb_log_outgoing_packet(connection, buffer, len, my_checksum);
 
-		char local_buffer[1024];
-		local_buffer[0] = '$';
-		if ((size_t)len + 4 <= sizeof(local_buffer)) {
-			/* performance gain on smaller packets by only a single call to gdb_write() */
-			memcpy(local_buffer + 1, buffer, len++);
-			len += snprintf(local_buffer + len, sizeof(local_buffer) - len, "#%02x", my_checksum);
-			retval = gdb_write(connection, local_buffer, len);
-			if (retval != ERROR_OK)
-				return retval;
-		} else {
-			/* larger packets are transmitted directly from caller supplied buffer
-			 * by several calls to gdb_write() to avoid dynamic allocation */
-			snprintf(local_buffer + 1, sizeof(local_buffer) - 1, "#%02x", my_checksum);
-			retval = gdb_write(connection, local_buffer, 1);
-			if (retval != ERROR_OK)
-				return retval;
-			retval = gdb_write(connection, buffer, len);
-			if (retval != ERROR_OK)
-				return retval;
-			retval = gdb_write(connection, local_buffer + 1, 3);
-			if (retval != ERROR_OK)
-				return retval;
-		}
+		/* the whole frame goes out with a single gdb_write() */
+		retval = gdb_write(connection, gdb_con->out_buf, frame_len);
+		if (retval != ERROR_OK)
+			return retval;
 
 		if (gdb_con->noack_mode)
 			break;
@@ -1018,6 +1078,8 @@ static int gdb_new_connection(struct connection *connection)
 	gdb_connection->target_desc.tdesc_length = 0;
 	gdb_connection->thread_list = NULL;
 	gdb_connection->output_flag = GDB_OUTPUT_NO;
+	gdb_connection->out_buf = NULL;
+	gdb_connection->out_buf_size = 0;
 
 	/* send ACK to GDB for debug request */
 	gdb_write(connection, "+", 1);
@@ -1135,6 +1197,7 @@ static int gdb_connection_closed(struct connection *connection)
 	/* if this connection registered a debug-message receiver delete it */
 	delete_debug_msg_receiver(connection->cmd_ctx, target);
 
+	free(gdb_connection->out_buf);
 	free(connection->priv);
 	connection->priv = NULL;
 
@@ -1492,8 +1555,32 @@ static int gdb_error(struct connection *connection, int retval)
 	return ERROR_OK;
 }
 
+/* Escape binary data for an 'x' reply. Output may overlap the tail of the
+ * input as long as it starts at least len bytes before it, since at most two
+ * bytes are written for each byte consumed.
+ */
+static size_t gdb_escape_binary(char *out, const uint8_t *data, uint32_t len)
+{
+	size_t pos = 0;
+
+	for (uint32_t i = 0; i < len; i++) {
+		uint8_t c = data[i];
+
+		if (c == '#' || c == '$' || c == '}' || c == '*') {
+			out[pos++] = '}';
+			out[pos++] = c ^ 0x20;
+		} else
+			out[pos++] = c;
+	}
+
+	return pos;
+}
+
 /* We don't have to worry about the default 2 second timeout for GDB packets,
  * because GDB breaks up large memory reads into smaller reads.
+ *
+ * Handles both the hex encoded 'm' packet and the binary 'x' packet. The
+ * latter halves the size of the reply, which matters for large reads.
  */
 static int gdb_read_memory_packet(struct connection *connection,
 		char const *packet, int packet_size)
@@ -1502,9 +1589,10 @@ static int gdb_read_memory_packet(struct connection *connection,
 	char *separator;
 	uint64_t addr = 0;
 	uint32_t len = 0;
+	bool binary = packet[0] == 'x';
 
 	uint8_t *buffer;
-	char *hex_buffer;
+	char *reply;
 
 	int retval = ERROR_OK;
 
@@ -1521,12 +1609,26 @@ static int gdb_read_memory_packet(struct connection *connection,
 	len = strtoul(separator + 1, NULL, 16);
 
 	if (!len) {
+		/* an empty 'x' read is valid and is answered with no data */
+		if (binary) {
+			gdb_put_packet(connection, "b", 1);
+			return ERROR_OK;
+		}
 		LOG_WARNING("invalid read memory packet received (len == 0)");
 		gdb_put_packet(connection, "", 0);
 		return ERROR_OK;
 	}
 
-	buffer = malloc(len);
+	/* Both encodings need at most 2 * len + 1 bytes. The target data is
+	 * read into the tail of the reply buffer and encoded in place, each
+	 * input byte being consumed before its output can reach it.
+	 */
+	reply = malloc(len * 2 + 1);
+	if (!reply) {
+		LOG_ERROR("Unable to allocate memory for read memory reply");
+		return gdb_error(connection, ERROR_FAIL);
+	}
+	buffer = (uint8_t *)reply + len + 1;
 
 	LOG_DEBUG("addr: 0x%16.16" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
 
@@ -1555,17 +1657,19 @@ static int gdb_read_memory_packet(struct connection *connection,
 	}
 
 	if (retval == ERROR_OK) {
-		hex_buffer = malloc(len * 2 + 1);
+		size_t pkt_len;
 
-		size_t pkt_len = hexify(hex_buffer, buffer, len, len * 2 + 1);
-
-		gdb_put_packet(connection, hex_buffer, pkt_len);
+		if (binary) {
+			reply[0] = 'b';
+			pkt_len = 1 + gdb_escape_binary(reply + 1, buffer, len);
+		} else
+			pkt_len = hexify(reply, buffer, len, len * 2 + 1);
 
-		free(hex_buffer);
+		gdb_put_packet(connection, reply, pkt_len);
 	} else
 		retval = gdb_error(connection, retval);
 
-	free(buffer);
+	free(reply);
 
 	return retval;
 }
@@ -3541,6 +3645,7 @@ static int gdb_input_inner(struct connection *connection)
 					retval = gdb_set_register_packet(connection, packet, packet_size);
 					break;
 				case 'm':
+				case 'x':
 					retval = gdb_read_memory_packet(connection, packet, packet_size);
 					break;
 				case 'M':
@@ -3899,6 +4004,15 @@ COMMAND_HANDLER(handle_gdb_memory_map_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_gdb_rle_compression_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ENABLE(CMD_ARGV[0], gdb_use_rle);
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_gdb_flash_program_command)
 {
 	if (CMD_ARGC != 1)
@@ -4033,6 +4147,13 @@ static const struct command_registration gdb_command_handlers[] = {
 		.help = "enable or disable memory map",
 		.usage = "('enable'|'disable')"
 	},
+	{
+		.name = "gdb_rle_compression",
+		.handler = handle_gdb_rle_compression_command,
+		.mode = COMMAND_CONFIG,
+		.help = "enable or disable run-length encoding of packets sent to gdb",
+		.usage = "('enable'|'disable')"
+	},
 	{
 		.name = "gdb_flash_program",
 		.handler = handle_gdb_flash_program_command,
@@ -32,7 +32,9 @@ struct image;
 struct reg;
 #include <target/target.h>
 
-#define GDB_BUFFER_SIZE 16384
+/* Advertised to GDB as PacketSize. Binary 'x' reads let GDB fetch close to
+ * this many bytes of target memory per packet. */
+#define GDB_BUFFER_SIZE 65536
 
 int gdb_target_add_all(struct target *target);
 int gdb_register_commands(struct command_context *command_context);
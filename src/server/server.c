@@ -45,6 +45,10 @@
 #include <netinet/tcp.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 static struct service *services;
 
 enum shutdown_reason {
@@ -64,6 +68,128 @@ static int polling_period = 100;
 /* address by name on which to listen for incoming TCP/IP connections */
 static char *bindto_name;
 
+#ifdef HAVE_SYS_EPOLL_H
+/* epoll instance watching the fds of all services and connections */
+static int epoll_fd = -1;
+
+/* readiness of each watched fd, indexed by fd */
+#define SERVER_FD_READY			1
+#define SERVER_FD_ALWAYS_READY	2
+static uint8_t *fd_state;
+static int fd_state_size;
+
+/* number of watched fds that epoll can't handle (e.g. stdin redirected
+ * from a regular file), these are always reported readable like select() */
+static int fd_always_ready_count;
+
+static void server_watch_fd(int fd)
+{
+	struct epoll_event ev;
+
+	if (fd < 0)
+		return;
+
+	if (epoll_fd == -1) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd == -1) {
+			LOG_ERROR("error creating epoll instance: %s", strerror(errno));
+			return;
+		}
+	}
+
+	if (fd >= fd_state_size) {
+		int new_size = MAX(fd + 1, 2 * fd_state_size);
+		uint8_t *new_state = realloc(fd_state, new_size);
+		if (!new_state) {
+			LOG_ERROR("Out of memory");
+			return;
+		}
+		memset(new_state + fd_state_size, 0, new_size - fd_state_size);
+		fd_state = new_state;
+		fd_state_size = new_size;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+		fd_state[fd] = 0;
+	} else if (errno == EPERM) {
+		fd_state[fd] = SERVER_FD_ALWAYS_READY;
+		fd_always_ready_count++;
+	} else if (errno != EEXIST) {
+		LOG_ERROR("error watching fd %d: %s", fd, strerror(errno));
+	}
+}
+
+static void server_unwatch_fd(int fd)
+{
+	if (fd < 0 || fd >= fd_state_size || epoll_fd == -1)
+		return;
+
+	if (fd_state[fd] & SERVER_FD_ALWAYS_READY)
+		fd_always_ready_count--;
+	else
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	fd_state[fd] = 0;
+}
+
+static bool server_fd_is_ready(int fd)
+{
+	return fd >= 0 && fd < fd_state_size && fd_state[fd];
+}
+
+/* events returned by the last epoll_wait() */
+static struct epoll_event ready_events[64];
+static int num_ready_events;
+
+/* wait for activity on any watched fd, returns the number of ready fds
+ * like select() */
+static int server_wait_epoll(int timeout_ms)
+{
+	int n = 0;
+
+	if (fd_always_ready_count)
+		timeout_ms = 0;
+
+	if (epoll_fd != -1) {
+		n = epoll_wait(epoll_fd, ready_events, ARRAY_SIZE(ready_events), timeout_ms);
+		if (n == -1)
+			return -1;
+	} else if (timeout_ms > 0) {
+		/* nothing to wait on, still keep the polling period */
+		usleep(timeout_ms * 1000);
+	}
+
+	num_ready_events = n;
+	for (int i = 0; i < n; i++)
+		if (ready_events[i].data.fd < fd_state_size)
+			fd_state[ready_events[i].data.fd] |= SERVER_FD_READY;
+
+	return n + fd_always_ready_count;
+}
+
+static void server_clear_ready(void)
+{
+	for (int i = 0; i < num_ready_events; i++)
+		if (ready_events[i].data.fd < fd_state_size)
+			fd_state[ready_events[i].data.fd] &= ~SERVER_FD_READY;
+	num_ready_events = 0;
+}
+
+#define SERVER_FD_ISSET(fd)		server_fd_is_ready(fd)
+#else
+static inline void server_watch_fd(int fd)
+{
+}
+
+static inline void server_unwatch_fd(int fd)
+{
+}
+
+#define SERVER_FD_ISSET(fd)		FD_ISSET(fd, &read_fds)
+#endif
+
 static int add_connection(struct service *service, struct command_context *cmd_ctx)
 {
 	socklen_t address_size;
@@ -157,6 +283,10 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 		;
 	*p = c;
 
+	/* pipe and stdin connections keep the fd already watched for the service */
+	if (service->type == CONNECTION_TCP)
+		server_watch_fd(c->fd);
+
 	if (service->max_connections != CONNECTION_LIMIT_UNLIMITED)
 		service->max_connections--;
 
@@ -172,9 +302,13 @@ static int remove_connection(struct service *service, struct connection *connect
 	while ((c = *p)) {
 		if (c->fd == connection->fd) {
 			service->connection_closed(c);
-			if (service->type == CONNECTION_TCP)
+			if (service->type == CONNECTION_TCP) {
+				server_unwatch_fd(c->fd);
 				close_socket(c->fd);
-			else if (service->type == CONNECTION_PIPE) {
+			} else if (service->type == CONNECTION_STDINOUT) {
+				/* stdin is not listened to again */
+				server_unwatch_fd(c->fd);
+			} else if (service->type == CONNECTION_PIPE) {
 				/* The service will listen to the pipe again */
 				c->service->fd = c->fd;
 			}
@@ -339,6 +473,8 @@ int add_service(const struct service_driver *driver, const char *port,
 #endif
 	}
 
+	server_watch_fd(c->fd);
+
 	/* add to the end of linked list */
 	for (p = &services; *p; p = &(*p)->next)
 		;
@@ -378,6 +514,7 @@ int remove_service(const char *name, const char *port)
 			else
 				prev->next = tmp->next;
 
+			server_unwatch_fd(tmp->fd);
 			if (tmp->type != CONNECTION_STDINOUT)
 				close_socket(tmp->fd);
 
@@ -400,6 +537,7 @@ static int remove_services(void)
 		struct service *next = c->next;
 
 		remove_connections(c);
+		server_unwatch_fd(c->fd);
 
 		free(c->name);
 
@@ -435,9 +573,11 @@ int server_loop(struct command_context *command_context)
 
 	bool poll_ok = true;
 
+#ifndef HAVE_SYS_EPOLL_H
 	/* used in select() */
 	fd_set read_fds;
 	int fd_max;
+#endif
 
 	/* used in accept() */
 	int retval;
@@ -450,6 +590,32 @@ int server_loop(struct command_context *command_context)
 #endif
 
 	while (shutdown_openocd == CONTINUE_MAIN_LOOP) {
+#ifdef HAVE_SYS_EPOLL_H
+		/* the epoll set is kept up to date when services and connections
+		 * come and go, just wait for the next ready fd or timer deadline */
+		server_clear_ready();
+
+		int timeout_ms = 0;
+		if (!poll_ok) {
+			/* Sleep until the next timer callback is due, at most
+			 * "poll_period" so that Jim events are still processed */
+			timeout_ms = next_event - timeval_ms();
+			if (timeout_ms < 0)
+				timeout_ms = 0;
+			else if (timeout_ms > polling_period)
+				timeout_ms = polling_period;
+		}
+		retval = server_wait_epoll(timeout_ms);
+
+		if (retval == -1) {
+			if (errno == EINTR)
+				server_clear_ready();
+			else {
+				LOG_ERROR("error during epoll_wait: %s", strerror(errno));
+				return ERROR_FAIL;
+			}
+		}
+#else
 		/* monitor sockets for activity */
 		fd_max = 0;
 		FD_ZERO(&read_fds);
@@ -516,6 +682,7 @@ int server_loop(struct command_context *command_context)
 			}
 #endif
 		}
+#endif
 
 		if (retval == 0) {
 			/* We only execute these callbacks when there was nothing to do or we timed
@@ -524,7 +691,9 @@ int server_loop(struct command_context *command_context)
 			next_event = target_timer_next_event();
 			process_jim_events(command_context);
 
+#ifndef HAVE_SYS_EPOLL_H
 			FD_ZERO(&read_fds);	/* eCos leaves read_fds unchanged in this case!  */
+#endif
 
 			/* We timed out/there was nothing to do, timeout rather than poll next time
 			 **/
@@ -544,7 +713,7 @@ int server_loop(struct command_context *command_context)
 		for (service = services; service; service = service->next) {
 			/* handle new connections on listeners */
 			if ((service->fd != -1)
-				&& (FD_ISSET(service->fd, &read_fds))) {
+				&& (SERVER_FD_ISSET(service->fd))) {
 				if (service->max_connections != 0)
 					add_connection(service, command_context);
 				else {
@@ -568,7 +737,7 @@ int server_loop(struct command_context *command_context)
 				struct connection *c;
 
 				for (c = service->connections; c; ) {
-					if ((c->fd >= 0 && FD_ISSET(c->fd, &read_fds)) || c->input_pending) {
+					if ((c->fd >= 0 && SERVER_FD_ISSET(c->fd)) || c->input_pending) {
 						retval = service->input(c);
 						if (retval != ERROR_OK) {
 							struct connection *next = c->next;
@@ -707,6 +876,17 @@ int server_quit(void)
 	remove_services();
 	target_quit();
 
+#ifdef HAVE_SYS_EPOLL_H
+	if (epoll_fd != -1) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+	free(fd_state);
+	fd_state = NULL;
+	fd_state_size = 0;
+	fd_always_ready_count = 0;
+#endif
+
 #ifdef _WIN32
 	SetConsoleCtrlHandler(control_handler, FALSE);
 
@@ -207,9 +207,15 @@ struct svf_check_tdo_para {
 	int bit_len;		/* bit length to check */
 };
 
+/* The check list starts at SVF_CHECK_TDO_PARA_SIZE entries and grows as
+ * needed; the queue is committed once SVF_MAX_CHECKS_TO_COMMIT are pending. */
 #define SVF_CHECK_TDO_PARA_SIZE 1024
+#define SVF_MAX_CHECKS_TO_COMMIT (64 * 1024)
 static struct svf_check_tdo_para *svf_check_tdo_para;
 static int svf_check_tdo_para_index;
+static int svf_check_tdo_para_size;
+/* line of the first failed TDO check, 0 if none */
+static int svf_tdo_error_line;
 
 static int svf_read_command_from_file(FILE *fd);
 static int svf_check_tdo(void);
@@ -225,6 +231,11 @@ static size_t svf_command_buffer_size;
 static int svf_line_number;
 static int svf_getline(char **lineptr, size_t *n, FILE *stream);
 
+/* svf_fd is read in blocks, lines are then split off in memory */
+#define SVF_READ_BUFFER_SIZE	(64 * 1024)
+static char svf_read_buffer[SVF_READ_BUFFER_SIZE];
+static size_t svf_read_buffer_pos, svf_read_buffer_len;
+
 #define SVF_MAX_BUFFER_SIZE_TO_COMMIT   (1024 * 1024)
 static uint8_t *svf_tdi_buffer, *svf_tdo_buffer, *svf_mask_buffer;
 static int svf_buffer_index, svf_buffer_size;
@@ -395,6 +406,8 @@ COMMAND_HANDLER(handle_svf_command)
 			svf_ignore_error = 1;
 		else {
 			svf_fd = fopen(CMD_ARGV[i], "r");
+			svf_read_buffer_pos = 0;
+			svf_read_buffer_len = 0;
 			if (!svf_fd) {
 				int err = errno;
 				command_print(CMD, "open(\"%s\"): %s", CMD_ARGV[i], strerror(err));
@@ -415,8 +428,10 @@ COMMAND_HANDLER(handle_svf_command)
 	svf_line_number = 0;
 	svf_command_buffer_size = 0;
 
+	svf_tdo_error_line = 0;
 	svf_check_tdo_para_index = 0;
-	svf_check_tdo_para = malloc(sizeof(struct svf_check_tdo_para) * SVF_CHECK_TDO_PARA_SIZE);
+	svf_check_tdo_para_size = SVF_CHECK_TDO_PARA_SIZE;
+	svf_check_tdo_para = malloc(sizeof(struct svf_check_tdo_para) * svf_check_tdo_para_size);
 	if (!svf_check_tdo_para) {
 		LOG_ERROR("not enough memory");
 		ret = ERROR_FAIL;
@@ -486,11 +501,18 @@ COMMAND_HANDLER(handle_svf_command)
 
 	if (svf_progress_enabled) {
 		/* Count total lines in file. */
-		while (!feof(svf_fd)) {
-			svf_getline(&svf_command_buffer, &svf_command_buffer_size, svf_fd);
-			svf_total_lines++;
+		svf_total_lines = 1;
+		size_t len;
+		while ((len = fread(svf_read_buffer, 1, SVF_READ_BUFFER_SIZE, svf_fd)) > 0) {
+			const char *p = svf_read_buffer, *end = svf_read_buffer + len;
+			while ((p = memchr(p, '\n', end - p))) {
+				svf_total_lines++;
+				p++;
+			}
 		}
 		rewind(svf_fd);
+		svf_read_buffer_pos = 0;
+		svf_read_buffer_len = 0;
 	}
 	while (svf_read_command_from_file(svf_fd) == ERROR_OK) {
 		/* Log Output */
@@ -511,7 +533,13 @@ COMMAND_HANDLER(handle_svf_command)
 		}
 		/* Run Command */
 		if (svf_run_command(CMD_CTX, svf_command_buffer) != ERROR_OK) {
-			LOG_ERROR("fail to run command at line %d", svf_line_number);
+			/* TDO is only checked once the queue is committed, which
+			 * can be many commands after the one that failed */
+			if (svf_tdo_error_line)
+				LOG_ERROR("tdo check failed at line %d, detected at line %d",
+					svf_tdo_error_line, svf_line_number);
+			else
+				LOG_ERROR("fail to run command at line %d", svf_line_number);
 			ret = ERROR_FAIL;
 			break;
 		}
@@ -549,6 +577,7 @@ free_all:
 	free(svf_check_tdo_para);
 	svf_check_tdo_para = NULL;
 	svf_check_tdo_para_index = 0;
+	svf_check_tdo_para_size = 0;
 
 	free(svf_tdi_buffer);
 	svf_tdi_buffer = NULL;
@@ -569,13 +598,15 @@ free_all:
 	svf_free_xxd_para(&svf_para.sdr_para);
 	svf_free_xxd_para(&svf_para.sir_para);
 
-	if (ret == ERROR_OK)
+	if (ret == ERROR_OK) {
 		command_print(CMD,
 			      "svf file programmed %s for %d commands with %d errors",
 			      (svf_ignore_error > 1) ? "unsuccessfully" : "successfully",
 			      command_num,
 			      (svf_ignore_error > 1) ? (svf_ignore_error - 1) : 0);
-	else
+		if (svf_tdo_error_line)
+			command_print(CMD, "first tdo check error at line %d", svf_tdo_error_line);
+	} else
 		command_print(CMD, "svf file programmed failed");
 
 	svf_ignore_error = 0;
@@ -584,32 +615,44 @@ free_all:
 
 static int svf_getline(char **lineptr, size_t *n, FILE *stream)
 {
-#define MIN_CHUNK 16	/* Buffer is increased by this size each time as required */
+#define MIN_CHUNK 256	/* Initial buffer size, doubled each time as required */
 	size_t i = 0;
 
-	if (!*lineptr) {
-		*n = MIN_CHUNK;
-		*lineptr = malloc(*n);
-		if (!*lineptr)
-			return -1;
-	}
-
-	(*lineptr)[0] = fgetc(stream);
-	while ((*lineptr)[i] != '\n') {
-		(*lineptr)[++i] = fgetc(stream);
-		if (feof(stream)) {
-			(*lineptr)[0] = 0;
-			return -1;
+	for (;;) {
+		if (svf_read_buffer_pos == svf_read_buffer_len) {
+			svf_read_buffer_pos = 0;
+			svf_read_buffer_len = fread(svf_read_buffer, 1, SVF_READ_BUFFER_SIZE, stream);
+			if (svf_read_buffer_len == 0) {
+				/* an unterminated last line is dropped */
+				if (*lineptr)
+					(*lineptr)[0] = 0;
+				return -1;
+			}
 		}
-		if ((i + 2) > *n) {
-			*n += MIN_CHUNK;
-			*lineptr = realloc(*lineptr, *n);
+
+		const char *start = svf_read_buffer + svf_read_buffer_pos;
+		size_t avail = svf_read_buffer_len - svf_read_buffer_pos;
+		const char *eol = memchr(start, '\n', avail);
+		size_t count = eol ? (size_t)(eol - start) + 1 : avail;
+
+		if (!*lineptr || i + count + 1 > *n) {
+			size_t size = MAX(*lineptr ? 2 * *n : MIN_CHUNK, i + count + 1);
+			char *line = realloc(*lineptr, size);
+			if (!line)
+				return -1;
+			*lineptr = line;
+			*n = size;
 		}
-	}
 
-	(*lineptr)[++i] = 0;
+		memcpy(*lineptr + i, start, count);
+		i += count;
+		svf_read_buffer_pos += count;
 
-	return sizeof(*lineptr);
+		if (eol) {
+			(*lineptr)[i] = 0;
+			return i;
+		}
+	}
 }
 
 #define SVFP_CMD_INC_CNT 1024
@@ -660,6 +703,14 @@ static int svf_read_command_from_file(FILE *fd)
 					break;
 				/* fallthrough */
 			default:
+			{
+				/* Ordinary characters (mostly hex digits) are
+				 * copied up to the next one that needs a look
+				 * of its own. */
+				size_t span = 1;
+				if (ch != '\n' && ch != '\r' && ch != '(' && ch != ')')
+					span = strcspn(&svf_read_line[i], "!/;\n\r()");
+
 				/* The parsing code currently expects a space
 				 * before parentheses -- "TDI (123)".  Also a
 				 * space afterwards -- "TDI (123) TDO(456)".
@@ -667,18 +718,20 @@ static int svf_read_command_from_file(FILE *fd)
 				 * parser updates, cope with that by adding the
 				 * spaces as needed.
 				 *
-				 * Ensure there are 3 bytes available, for:
-				 *  - current character
+				 * Ensure there are span + 2 bytes available, for:
+				 *  - the characters
 				 *  - added space.
 				 *  - terminating NUL ('\0')
 				 */
-				if (cmd_pos + 3 > svf_command_buffer_size) {
-					svf_command_buffer = realloc(svf_command_buffer, cmd_pos + 3);
-					svf_command_buffer_size = cmd_pos + 3;
-					if (!svf_command_buffer) {
+				if (cmd_pos + span + 2 > svf_command_buffer_size) {
+					size_t size = MAX(2 * svf_command_buffer_size, cmd_pos + span + 2);
+					char *buffer = realloc(svf_command_buffer, size);
+					if (!buffer) {
 						LOG_ERROR("not enough memory");
 						return ERROR_FAIL;
 					}
+					svf_command_buffer = buffer;
+					svf_command_buffer_size = size;
 				}
 
 				/* insert a space before '(' */
@@ -686,11 +739,15 @@ static int svf_read_command_from_file(FILE *fd)
 					svf_command_buffer[cmd_pos++] = ' ';
 
 				svf_command_buffer[cmd_pos++] = (char)toupper(ch);
+				for (size_t j = 1; j < span; j++)
+					svf_command_buffer[cmd_pos++] = (char)toupper(svf_read_line[i + j]);
+				i += span - 1;
 
 				/* insert a space after ')' */
 				if (')' == ch)
 					svf_command_buffer[cmd_pos++] = ' ';
 				break;
+			}
 		}
 		ch = svf_read_line[++i];
 	}
@@ -785,6 +842,13 @@ static int svf_set_padding(struct svf_xxr_para *para, int len, unsigned char tdi
 	return error;
 }
 
+/* value + 1 of each hex digit, 0 for anything else */
+static const uint8_t svf_hex_digit[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
 static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_len, int bit_len)
 {
 	int i, str_len = strlen(str), str_hbyte_len = (bit_len + 3) >> 2;
@@ -807,17 +871,12 @@ static int svf_copy_hexstring_to_binary(char *str, uint8_t **bin, int orig_bit_l
 			 * require line ends for correctness, since there is
 			 * a hard limit on line length.
 			 */
-			if (!isspace(ch)) {
-				if ((ch >= '0') && (ch <= '9')) {
-					ch = ch - '0';
-					break;
-				} else if ((ch >= 'A') && (ch <= 'F')) {
-					ch = ch - 'A' + 10;
-					break;
-				} else {
-					LOG_ERROR("invalid hex string");
-					return ERROR_FAIL;
-				}
+			if (svf_hex_digit[ch]) {
+				ch = svf_hex_digit[ch] - 1;
+				break;
+			} else if (!isspace(ch)) {
+				LOG_ERROR("invalid hex string");
+				return ERROR_FAIL;
 			}
 
 			ch = 0;
@@ -860,6 +919,8 @@ static int svf_check_tdo(void)
 				&svf_mask_buffer[index_var], len)) {
 			LOG_ERROR("tdo check error at line %d",
 				svf_check_tdo_para[i].line_num);
+			if (!svf_tdo_error_line)
+				svf_tdo_error_line = svf_check_tdo_para[i].line_num;
 			SVF_BUF_LOG(ERROR, &svf_tdi_buffer[index_var], len, "READ");
 			SVF_BUF_LOG(ERROR, &svf_tdo_buffer[index_var], len, "WANT");
 			SVF_BUF_LOG(ERROR, &svf_mask_buffer[index_var], len, "MASK");
@@ -877,9 +938,15 @@ static int svf_check_tdo(void)
 
 static int svf_add_check_para(uint8_t enabled, int buffer_offset, int bit_len)
 {
-	if (svf_check_tdo_para_index >= SVF_CHECK_TDO_PARA_SIZE) {
-		LOG_ERROR("toooooo many operation undone");
-		return ERROR_FAIL;
+	if (svf_check_tdo_para_index >= svf_check_tdo_para_size) {
+		struct svf_check_tdo_para *para = realloc(svf_check_tdo_para,
+				sizeof(struct svf_check_tdo_para) * svf_check_tdo_para_size * 2);
+		if (!para) {
+			LOG_ERROR("not enough memory");
+			return ERROR_FAIL;
+		}
+		svf_check_tdo_para = para;
+		svf_check_tdo_para_size *= 2;
 	}
 
 	svf_check_tdo_para[svf_check_tdo_para_index].line_num = svf_line_number;
@@ -1186,9 +1253,10 @@ xxr_common:
 							svf_para.tdr_para.len);
 					i += svf_para.tdr_para.len;
 
-					svf_add_check_para(1, svf_buffer_index, i);
-				} else
-					svf_add_check_para(0, svf_buffer_index, i);
+				}
+				if (svf_add_check_para(svf_para.sdr_para.data_mask & XXR_TDO ? 1 : 0,
+						svf_buffer_index, i) != ERROR_OK)
+					return ERROR_FAIL;
 				field.num_bits = i;
 				field.out_value = &svf_tdi_buffer[svf_buffer_index];
 				field.in_value = (xxr_para_tmp->data_mask & XXR_TDO) ? &svf_tdi_buffer[svf_buffer_index] : NULL;
@@ -1276,9 +1344,10 @@ xxr_common:
 							svf_para.tir_para.len);
 					i += svf_para.tir_para.len;
 
-					svf_add_check_para(1, svf_buffer_index, i);
-				} else
-					svf_add_check_para(0, svf_buffer_index, i);
+				}
+				if (svf_add_check_para(svf_para.sir_para.data_mask & XXR_TDO ? 1 : 0,
+						svf_buffer_index, i) != ERROR_OK)
+					return ERROR_FAIL;
 				field.num_bits = i;
 				field.out_value = &svf_tdi_buffer[svf_buffer_index];
 				field.in_value = (xxr_para_tmp->data_mask & XXR_TDO) ? &svf_tdi_buffer[svf_buffer_index] : NULL;
@@ -1541,7 +1610,7 @@ xxr_common:
 		/* for fast executing, execute tap if necessary */
 		/* half of the buffer is for the next command */
 		if (((svf_buffer_index >= SVF_MAX_BUFFER_SIZE_TO_COMMIT) ||
-				(svf_check_tdo_para_index >= SVF_CHECK_TDO_PARA_SIZE / 2)) &&
+				(svf_check_tdo_para_index >= SVF_MAX_CHECKS_TO_COMMIT)) &&
 				(((command != STATE) && (command != RUNTEST)) ||
 						((command == STATE) && (num_of_argu == 2))))
 			return svf_execute_tap();
@@ -22,6 +22,7 @@
 #include "config.h"
 #endif
 
+#include <stdarg.h>
 #include <stdlib.h>
 #include <jim.h>
 
@@ -87,6 +88,54 @@ struct arm_tpiu_swo_event_action {
 	struct arm_tpiu_swo_event_action *next;
 };
 
+/* ITM/DWT packet sources that can be routed to a sink */
+enum arm_tpiu_swo_sink_source {
+	TPIU_SWO_SINK_STIMULUS,
+	TPIU_SWO_SINK_PC_SAMPLE,
+	TPIU_SWO_SINK_EXCEPTION,
+};
+
+#define ITM_STIMULUS_PORTS              32
+
+struct arm_tpiu_swo_sink {
+	struct list_head lh;
+	enum arm_tpiu_swo_sink_source source;
+	/** stimulus port number, only for TPIU_SWO_SINK_STIMULUS */
+	unsigned int port;
+	/** file name or ':' followed by the TCP port */
+	char *dest;
+	FILE *file;
+	/** track TCP connections */
+	struct list_head connections;
+	/** decoded data waiting to be written out */
+	uint8_t *buf;
+	size_t buf_used;
+	/** a write to the destination failed since the last poll */
+	bool write_failed;
+};
+
+enum arm_tpiu_swo_decoder_state {
+	ITM_STATE_HEADER,
+	ITM_STATE_PAYLOAD,
+	ITM_STATE_CONTINUATION,
+};
+
+struct arm_tpiu_swo_decoder {
+	enum arm_tpiu_swo_decoder_state state;
+	uint8_t header;
+	uint8_t payload[4];
+	unsigned int payload_len;
+	unsigned int expected_len;
+	/** consecutive zero bytes seen, to detect synchronization packets */
+	unsigned int zeros;
+	/** sinks indexed by packet source, built when the output is opened */
+	struct arm_tpiu_swo_sink *stimulus[ITM_STIMULUS_PORTS];
+	struct arm_tpiu_swo_sink *pc_sample;
+	struct arm_tpiu_swo_sink *exception;
+	/** number of overflow packets received */
+	uint64_t overflows;
+};
+
 struct arm_tpiu_swo_object {
 	struct list_head lh;
 	struct adiv5_mem_ap_spot spot;
@@ -112,6 +161,10 @@ struct arm_tpiu_swo_object {
 	char *out_filename;
 	/** track TCP connections */
 	struct list_head connections;
+	/** destinations of the decoded ITM/DWT packets */
+	struct list_head sinks;
+	/** ITM/DWT packet decoder */
+	struct arm_tpiu_swo_decoder decoder;
 	/* START_DEPRECATED_TPIU */
 	bool recheck_ap_cur_target;
 	/* END_DEPRECATED_TPIU */
@@ -124,11 +177,171 @@ struct arm_tpiu_swo_connection {
 
 struct arm_tpiu_swo_priv_connection {
 	struct arm_tpiu_swo_object *obj;
+	/** sink served by the connection, NULL for the raw trace data */
+	struct arm_tpiu_swo_sink *sink;
 };
 
 static LIST_HEAD(all_tpiu_swo);
 
 #define ARM_TPIU_SWO_TRACE_BUF_SIZE	4096
+/* decoded output of one trace buffer is at most ~4.5 times its size,
+ * so a sink normally writes its destination once per poll */
+#define ARM_TPIU_SWO_SINK_BUF_SIZE	65536
+
+/* ITM protocol packet headers, see ARMv7-M ARM, appendix D4 */
+#define ITM_HEADER_OVERFLOW             0x70
+#define ITM_HEADER_SYNC_END             0x80
+#define ITM_SYNC_MIN_ZEROS              5
+#define ITM_MAX_CONTINUATION            6
+
+/* DWT hardware source packet discriminator IDs */
+#define DWT_ID_EXCEPTION                1
+#define DWT_ID_PC_SAMPLE                2
+
+static const char * const itm_exception_functions[] = {
+	"reserved", "entered", "exited", "returned",
+};
+
+/* Write the buffered data out; like the raw trace output this blocks
+ * until the destination has taken all of it */
+static void arm_tpiu_swo_sink_flush(struct arm_tpiu_swo_sink *sink)
+{
+	struct arm_tpiu_swo_connection *c;
+
+	if (!sink->buf_used)
+		return;
+
+	if (sink->file) {
+		if (fwrite(sink->buf, 1, sink->buf_used, sink->file) != sink->buf_used) {
+			LOG_ERROR("Error writing to the SWO decoder destination file %s", sink->dest);
+			sink->write_failed = true;
+		}
+	} else {
+		list_for_each_entry(c, &sink->connections, lh)
+			if (connection_write(c->connection, sink->buf, sink->buf_used) != (int)sink->buf_used)
+				LOG_ERROR("Error writing to connection");
+	}
+
+	sink->buf_used = 0;
+}
+
+static void arm_tpiu_swo_sink_append(struct arm_tpiu_swo_sink *sink,
+		const uint8_t *data, size_t size)
+{
+	while (size) {
+		if (sink->buf_used == ARM_TPIU_SWO_SINK_BUF_SIZE)
+			arm_tpiu_swo_sink_flush(sink);
+
+		size_t chunk = MIN(size, ARM_TPIU_SWO_SINK_BUF_SIZE - sink->buf_used);
+
+		memcpy(sink->buf + sink->buf_used, data, chunk);
+		sink->buf_used += chunk;
+		data += chunk;
+		size -= chunk;
+	}
+}
+
+static void arm_tpiu_swo_sink_printf(struct arm_tpiu_swo_sink *sink,
+		const char *format, ...)
+{
+	char line[32];
+	va_list ap;
+
+	va_start(ap, format);
+	int len = vsnprintf(line, sizeof(line), format, ap);
+	va_end(ap);
+
+	if (len > 0)
+		arm_tpiu_swo_sink_append(sink, (const uint8_t *)line, MIN((size_t)len, sizeof(line) - 1));
+}
+
+static void arm_tpiu_swo_decode_packet(struct arm_tpiu_swo_decoder *d)
+{
+	struct arm_tpiu_swo_sink *sink;
+	uint32_t value = 0;
+
+	for (unsigned int i = 0; i < d->payload_len; i++)
+		value |= (uint32_t)d->payload[i] << (8 * i);
+
+	/* software source: instrumentation stimulus port */
+	if (!(d->header & BIT(2))) {
+		sink = d->stimulus[d->header >> 3];
+		if (sink)
+			arm_tpiu_swo_sink_append(sink, d->payload, d->payload_len);
+		return;
+	}
+
+	/* hardware source: DWT */
+	switch (d->header >> 3) {
+	case DWT_ID_EXCEPTION:
+		sink = d->exception;
+		if (sink && d->payload_len == 2)
+			arm_tpiu_swo_sink_printf(sink, "%s %u\n",
+				itm_exception_functions[(value >> 12) & 3], value & 0x1ff);
+		break;
+	case DWT_ID_PC_SAMPLE:
+		sink = d->pc_sample;
+		if (!sink)
+			break;
+		if (d->payload_len == 4)
+			arm_tpiu_swo_sink_printf(sink, "0x%08" PRIx32 "\n", value);
+		else
+			arm_tpiu_swo_sink_printf(sink, "sleep\n");
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Streaming decoder of the ITM/DWT packet protocol. Packets can be split
+ * across calls; the decoder state is kept in the TPIU/SWO object.
+ */
+static void arm_tpiu_swo_decode(struct arm_tpiu_swo_decoder *d,
+		const uint8_t *buf, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		uint8_t b = buf[i];
+
+		/* a synchronization packet recovers from any state */
+		if (b == ITM_HEADER_SYNC_END && d->zeros >= ITM_SYNC_MIN_ZEROS) {
+			d->zeros = 0;
+			d->state = ITM_STATE_HEADER;
+			continue;
+		}
+		d->zeros = b ? 0 : d->zeros + 1;
+
+		switch (d->state) {
+		case ITM_STATE_HEADER:
+			if (b & 3) {
+				/* source packet, payload of 1, 2 or 4 bytes */
+				d->header = b;
+				d->expected_len = ((b & 3) == 3) ? 4 : (b & 3);
+				d->payload_len = 0;
+				d->state = ITM_STATE_PAYLOAD;
+			} else if (b == ITM_HEADER_OVERFLOW) {
+				d->overflows++;
+			} else if (b & 0x80) {
+				/* timestamp or extension packet with continuation bytes */
+				d->payload_len = 0;
+				d->state = ITM_STATE_CONTINUATION;
+			}
+			/* zero bytes are part of synchronization packets */
+			break;
+		case ITM_STATE_PAYLOAD:
+			d->payload[d->payload_len++] = b;
+			if (d->payload_len == d->expected_len) {
+				arm_tpiu_swo_decode_packet(d);
+				d->state = ITM_STATE_HEADER;
+			}
+			break;
+		case ITM_STATE_CONTINUATION:
+			if (!(b & 0x80) || ++d->payload_len == ITM_MAX_CONTINUATION)
+				d->state = ITM_STATE_HEADER;
+			break;
+		}
+	}
+}
 
 static int arm_tpiu_swo_poll_trace(void *priv)
 {
@@ -157,6 +370,23 @@ static int arm_tpiu_swo_poll_trace(void *priv)
 			if (connection_write(c->connection, buf, size) != (int)size)
 				LOG_ERROR("Error writing to connection"); /* FIXME: which connection? */
 
+	if (!list_empty(&obj->sinks)) {
+		struct arm_tpiu_swo_sink *sink;
+
+		arm_tpiu_swo_decode(&obj->decoder, buf, size);
+
+		list_for_each_entry(sink, &obj->sinks, lh) {
+			arm_tpiu_swo_sink_flush(sink);
+			if (sink->file)
+				fflush(sink->file);
+			if (sink->write_failed) {
+				sink->write_failed = false;
+				retval = ERROR_FAIL;
+			}
+		}
+		return retval;
+	}
+
 	return ERROR_OK;
 }
 
@@ -194,6 +424,26 @@ static void arm_tpiu_swo_handle_event(struct arm_tpiu_swo_object *obj, enum arm_
 	}
 }
 
+static void arm_tpiu_swo_close_sinks(struct arm_tpiu_swo_object *obj)
+{
+	struct arm_tpiu_swo_sink *sink;
+
+	list_for_each_entry(sink, &obj->sinks, lh) {
+		if (sink->file) {
+			fclose(sink->file);
+			sink->file = NULL;
+		}
+		if (sink->dest[0] == ':')
+			remove_service(TCP_SERVICE_NAME, &sink->dest[1]);
+		free(sink->buf);
+		sink->buf = NULL;
+	}
+
+	if (obj->decoder.overflows)
+		LOG_WARNING("%s: %" PRIu64 " ITM overflow packets received",
+			obj->name, obj->decoder.overflows);
+}
+
 static void arm_tpiu_swo_close_output(struct arm_tpiu_swo_object *obj)
 {
 	if (obj->file) {
@@ -202,6 +452,18 @@ static void arm_tpiu_swo_close_output(struct arm_tpiu_swo_object *obj)
 	}
 	if (obj->out_filename && obj->out_filename[0] == ':')
 		remove_service(TCP_SERVICE_NAME, &obj->out_filename[1]);
+	arm_tpiu_swo_close_sinks(obj);
+}
+
+static void arm_tpiu_swo_free_sinks(struct arm_tpiu_swo_object *obj)
+{
+	struct arm_tpiu_swo_sink *sink, *tmp;
+
+	list_for_each_entry_safe(sink, tmp, &obj->sinks, lh) {
+		list_del(&sink->lh);
+		free(sink->dest);
+		free(sink);
+	}
 }
 
 int arm_tpiu_swo_cleanup_all(void)
@@ -233,6 +495,7 @@ int arm_tpiu_swo_cleanup_all(void)
 			ea = next;
 		}
 
+		arm_tpiu_swo_free_sinks(obj);
 		free(obj->name);
 		free(obj->out_filename);
 		free(obj);
@@ -251,7 +514,7 @@ static int arm_tpiu_swo_service_new_connection(struct connection *connection)
 		return ERROR_FAIL;
 	}
 	c->connection = connection;
-	list_add(&c->lh, &obj->connections);
+	list_add(&c->lh, priv->sink ? &priv->sink->connections : &obj->connections);
 	return ERROR_OK;
 }
 
@@ -275,9 +538,10 @@ static int arm_tpiu_swo_service_connection_closed(struct connection *connection)
 {
 	struct arm_tpiu_swo_priv_connection *priv = connection->service->priv;
 	struct arm_tpiu_swo_object *obj = priv->obj;
+	struct list_head *connections = priv->sink ? &priv->sink->connections : &obj->connections;
 	struct arm_tpiu_swo_connection *c, *tmp;
 
-	list_for_each_entry_safe(c, tmp, &obj->connections, lh)
+	list_for_each_entry_safe(c, tmp, connections, lh)
 		if (c->connection == connection) {
 			list_del(&c->lh);
 			free(c);
@@ -287,6 +551,105 @@ static int arm_tpiu_swo_service_connection_closed(struct connection *connection)
 	return ERROR_FAIL;
 }
 
+static const char *arm_tpiu_swo_sink_source_name(enum arm_tpiu_swo_sink_source source)
+{
+	switch (source) {
+	case TPIU_SWO_SINK_STIMULUS:
+		return "stimulus";
+	case TPIU_SWO_SINK_PC_SAMPLE:
+		return "pc";
+	case TPIU_SWO_SINK_EXCEPTION:
+		return "exception";
+	}
+	return "unknown";
+}
+
+COMMAND_HANDLER(handle_arm_tpiu_swo_decode)
+{
+	struct arm_tpiu_swo_object *obj = CMD_DATA;
+	struct arm_tpiu_swo_sink *sink, *tmp;
+	enum arm_tpiu_swo_sink_source source;
+	unsigned int port = 0;
+	const char *dest;
+
+	if (!CMD_ARGC) {
+		list_for_each_entry(sink, &obj->sinks, lh) {
+			if (sink->source == TPIU_SWO_SINK_STIMULUS)
+				command_print(CMD, "%s %u: %s", arm_tpiu_swo_sink_source_name(sink->source),
+					sink->port, sink->dest);
+			else
+				command_print(CMD, "%s: %s", arm_tpiu_swo_sink_source_name(sink->source),
+					sink->dest);
+		}
+		return ERROR_OK;
+	}
+
+	if (!strcmp(CMD_ARGV[0], "stimulus")) {
+		if (CMD_ARGC != 3)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], port);
+		if (port >= ITM_STIMULUS_PORTS) {
+			command_print(CMD, "Invalid stimulus port %u", port);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		source = TPIU_SWO_SINK_STIMULUS;
+	} else if (!strcmp(CMD_ARGV[0], "pc")) {
+		if (CMD_ARGC != 2)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		source = TPIU_SWO_SINK_PC_SAMPLE;
+	} else if (!strcmp(CMD_ARGV[0], "exception")) {
+		if (CMD_ARGC != 2)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		source = TPIU_SWO_SINK_EXCEPTION;
+	} else {
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+
+	if (obj->enabled) {
+		command_print(CMD, "Cannot change decoder outputs; %s is enabled", obj->name);
+		return ERROR_FAIL;
+	}
+
+	dest = CMD_ARGV[CMD_ARGC - 1];
+	if (dest[0] == ':') {
+		char *end;
+		long tcp_port = strtol(dest + 1, &end, 0);
+		if (tcp_port <= 0 || tcp_port > UINT16_MAX || *end != '\0') {
+			command_print(CMD, "Invalid TCP port '%s'", dest + 1);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+	}
+
+	/* replace existing */
+	list_for_each_entry_safe(sink, tmp, &obj->sinks, lh)
+		if (sink->source == source && sink->port == port) {
+			list_del(&sink->lh);
+			free(sink->dest);
+			free(sink);
+		}
+
+	if (!strcmp(dest, "none"))
+		return ERROR_OK;
+
+	sink = calloc(1, sizeof(*sink));
+	if (!sink) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	sink->dest = strdup(dest);
+	if (!sink->dest) {
+		LOG_ERROR("Out of memory");
+		free(sink);
+		return ERROR_FAIL;
+	}
+	sink->source = source;
+	sink->port = port;
+	INIT_LIST_HEAD(&sink->connections);
+	list_add_tail(&sink->lh, &obj->sinks);
+
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_arm_tpiu_swo_event_list)
 {
 	struct arm_tpiu_swo_object *obj = CMD_DATA;
@@ -591,6 +954,62 @@ static const struct service_driver arm_tpiu_swo_service_driver = {
 	.keep_client_alive_handler = NULL,
 };
 
+static int arm_tpiu_swo_open_sinks(struct arm_tpiu_swo_object *obj)
+{
+	struct arm_tpiu_swo_decoder *d = &obj->decoder;
+	struct arm_tpiu_swo_sink *sink;
+
+	memset(d, 0, sizeof(*d));
+
+	list_for_each_entry(sink, &obj->sinks, lh) {
+		sink->buf = malloc(ARM_TPIU_SWO_SINK_BUF_SIZE);
+		if (!sink->buf) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		sink->buf_used = 0;
+		sink->write_failed = false;
+
+		if (sink->dest[0] == ':') {
+			struct arm_tpiu_swo_priv_connection *priv = malloc(sizeof(*priv));
+			if (!priv) {
+				LOG_ERROR("Out of memory");
+				return ERROR_FAIL;
+			}
+			priv->obj = obj;
+			priv->sink = sink;
+			LOG_INFO("starting %s decoder server for %s on %s",
+				arm_tpiu_swo_sink_source_name(sink->source), obj->name, &sink->dest[1]);
+			int retval = add_service(&arm_tpiu_swo_service_driver, &sink->dest[1],
+				CONNECTION_LIMIT_UNLIMITED, priv);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("Can't configure decoder TCP port %s", &sink->dest[1]);
+				return ERROR_FAIL;
+			}
+		} else {
+			sink->file = fopen(sink->dest, "ab");
+			if (!sink->file) {
+				LOG_ERROR("Can't open decoder destination file \"%s\"", sink->dest);
+				return ERROR_FAIL;
+			}
+		}
+
+		switch (sink->source) {
+		case TPIU_SWO_SINK_STIMULUS:
+			d->stimulus[sink->port] = sink;
+			break;
+		case TPIU_SWO_SINK_PC_SAMPLE:
+			d->pc_sample = sink;
+			break;
+		case TPIU_SWO_SINK_EXCEPTION:
+			d->exception = sink;
+			break;
+		}
+	}
+
+	return ERROR_OK;
+}
+
 static int jim_arm_tpiu_swo_enable(Jim_Interp *interp, int argc, Jim_Obj *const *argv)
 {
 	struct command *c = jim_to_command(interp);
@@ -698,14 +1117,22 @@ static int jim_arm_tpiu_swo_enable(Jim_Interp *interp, int argc, Jim_Obj *const
 	uint16_t prescaler = 1; /* dummy value */
 	unsigned int swo_pin_freq = obj->swo_pin_freq; /* could be replaced */
 
-	if (obj->out_filename && strcmp(obj->out_filename, "external") && obj->out_filename[0]) {
-		if (obj->out_filename[0] == ':') {
+	bool raw_output = obj->out_filename && strcmp(obj->out_filename, "external") && obj->out_filename[0];
+
+	if (raw_output || !list_empty(&obj->sinks)) {
+		if (!list_empty(&obj->sinks) && obj->en_formatter) {
+			LOG_ERROR("Decoding of ITM/DWT packets requires the formatter to be disabled");
+			return JIM_ERR;
+		}
+
+		if (raw_output && obj->out_filename[0] == ':') {
 			struct arm_tpiu_swo_priv_connection *priv = malloc(sizeof(*priv));
 			if (!priv) {
 				LOG_ERROR("Out of memory");
 				return JIM_ERR;
 			}
 			priv->obj = obj;
+			priv->sink = NULL;
 			LOG_INFO("starting trace server for %s on %s", obj->name, &obj->out_filename[1]);
 			retval = add_service(&arm_tpiu_swo_service_driver, &obj->out_filename[1],
 				CONNECTION_LIMIT_UNLIMITED, priv);
@@ -713,7 +1140,7 @@ static int jim_arm_tpiu_swo_enable(Jim_Interp *interp, int argc, Jim_Obj *const
 				LOG_ERROR("Can't configure trace TCP port %s", &obj->out_filename[1]);
 				return JIM_ERR;
 			}
-		} else if (strcmp(obj->out_filename, "-")) {
+		} else if (raw_output && strcmp(obj->out_filename, "-")) {
 			obj->file = fopen(obj->out_filename, "ab");
 			if (!obj->file) {
 				LOG_ERROR("Can't open trace destination file \"%s\"", obj->out_filename);
@@ -721,6 +1148,11 @@ static int jim_arm_tpiu_swo_enable(Jim_Interp *interp, int argc, Jim_Obj *const
 			}
 		}
 
+		if (arm_tpiu_swo_open_sinks(obj) != ERROR_OK) {
+			arm_tpiu_swo_close_output(obj);
+			return JIM_ERR;
+		}
+
 		retval = adapter_config_trace(true, obj->pin_protocol, obj->port_width,
 			&swo_pin_freq, obj->traceclkin_freq, &prescaler);
 		if (retval != ERROR_OK) {
@@ -873,6 +1305,13 @@ static const struct command_registration arm_tpiu_swo_instance_command_handlers[
 		.help = "displays a table of events defined for this TPIU/SWO",
 		.usage = "",
 	},
+	{
+		.name = "decode",
+		.mode = COMMAND_ANY,
+		.handler = handle_arm_tpiu_swo_decode,
+		.help = "route decoded ITM/DWT packets to a file or TCP port, or list the routes",
+		.usage = "[(stimulus port | pc | exception) (filename | :port | none)]",
+	},
 	{
 		.name = "enable",
 		.mode = COMMAND_ANY,
@@ -942,6 +1381,7 @@ static int jim_arm_tpiu_swo_create(Jim_Interp *interp, int argc, Jim_Obj *const
 		return JIM_ERR;
 	}
 	INIT_LIST_HEAD(&obj->connections);
+	INIT_LIST_HEAD(&obj->sinks);
 	adiv5_mem_ap_spot_init(&obj->spot);
 	obj->spot.base = TPIU_SWO_DEFAULT_BASE;
 	obj->port_width = 1;
@@ -120,6 +120,7 @@ static const struct cortex_m_part_info cortex_m_parts[] = {
 static int cortex_m_store_core_reg_u32(struct target *target,
 		uint32_t num, uint32_t value);
 static void cortex_m_dwt_free(struct target *target);
+static int cortex_m_update_soft_breakpoints(struct target *target, bool set);
 
 /** DCB DHCSR register contains S_RETIRE_ST and S_RESET_ST bits cleared
  *  on a read. Call this helper function each time DHCSR is read
@@ -419,6 +420,151 @@ static int cortex_m_store_core_reg_u32(struct target *target,
 	return retval;
 }
 
+static int cortex_m_queue_reg_write(struct target *target, uint32_t regsel,
+		uint32_t reg_value, uint32_t *dhcsr)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	int retval;
+
+	retval = mem_ap_write_u32(armv7m->debug_ap, DCB_DCRDR, reg_value);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = mem_ap_write_u32(armv7m->debug_ap, DCB_DCRSR, regsel | DCRSR_WNR);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return mem_ap_read_u32(armv7m->debug_ap, DCB_DHCSR, dhcsr);
+}
+
+/* Write back all dirty registers in one queued transaction, the counterpart
+ * of cortex_m_fast_read_all_regs(). S_REGRDY is sampled after each write and
+ * checked once the queue has run. If any write was not ready the registers
+ * stay dirty and ERROR_TIMEOUT_REACHED is returned, so the caller can redo
+ * them with the polling armv7m_restore_context(). */
+static int cortex_m_fast_write_dirty_regs(struct target *target)
+{
+	struct cortex_m_common *cortex_m = target_to_cm(target);
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct reg_cache *cache = armv7m->arm.core_cache;
+	int retval;
+	uint32_t dcrdr;
+
+	const unsigned int n_r32 = ARMV7M_LAST_REG - ARMV7M_CORE_FIRST_REG + 1
+							   + ARMV7M_FPU_LAST_REG - ARMV7M_FPU_FIRST_REG + 1;
+	uint32_t dhcsr[n_r32];
+	unsigned int wi = 0; /* write index to dhcsr array */
+	int reg_id;
+
+	/* Merge dirty packed registers into their 32-bit containers first.
+	 * A container that is not cached is left to the slow path, which
+	 * reads it before merging. */
+	for (reg_id = cache->num_regs - 1; reg_id >= 0; reg_id--) {
+		struct reg *r = &cache->reg_list[reg_id];
+		unsigned int reg32_id;
+		uint32_t offset;
+
+		if (!r->exist || !r->dirty)
+			continue;
+		if (!armv7m_map_reg_packing(reg_id, &reg32_id, &offset))
+			continue;
+
+		struct reg *r32 = &cache->reg_list[reg32_id];
+		if (!r32->valid)
+			continue;
+
+		buf_cpy(r->value, r32->value + offset, r->size);
+		r32->dirty = true;
+		r->dirty = false;
+	}
+
+	/* because the DCB_DCRDR is used for the emulated dcc channel
+	 * we have to save/restore the DCB_DCRDR when used */
+	if (target->dbg_msg_enabled) {
+		retval = mem_ap_read_u32(armv7m->debug_ap, DCB_DCRDR, &dcrdr);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	for (reg_id = cache->num_regs - 1; reg_id >= 0; reg_id--) {
+		struct reg *r = &cache->reg_list[reg_id];
+
+		if (!r->exist || !r->dirty || r->size <= 8)
+			continue;
+
+		assert(r->size == 32 || r->size == 64);
+		uint32_t regsel = armv7m_map_id_to_regsel(reg_id);
+		retval = cortex_m_queue_reg_write(target, regsel,
+				buf_get_u32(r->value, 0, 32), &dhcsr[wi]);
+		if (retval != ERROR_OK)
+			return retval;
+		wi++;
+
+		if (r->size == 64) {
+			/* the odd part of FP register (S1, S3...) */
+			retval = cortex_m_queue_reg_write(target, regsel + 1,
+					buf_get_u32(r->value + 4, 0, 32), &dhcsr[wi]);
+			if (retval != ERROR_OK)
+				return retval;
+			wi++;
+		}
+	}
+
+	if (!wi)
+		return ERROR_OK;
+
+	assert(wi <= n_r32);
+
+	retval = dap_run(armv7m->debug_ap->dap);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (target->dbg_msg_enabled) {
+		/* restore DCB_DCRDR - this needs to be in a separate
+		 * transaction otherwise the emulated DCC channel breaks */
+		retval = mem_ap_write_atomic_u32(armv7m->debug_ap, DCB_DCRDR, dcrdr);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+
+	bool not_ready = false;
+	for (unsigned int i = 0; i < wi; i++) {
+		if ((dhcsr[i] & S_REGRDY) == 0) {
+			not_ready = true;
+			LOG_TARGET_DEBUG(target, "Register %u was not ready during fast write", i);
+		}
+		cortex_m_cumulate_dhcsr_sticky(cortex_m, dhcsr[i]);
+	}
+
+	if (not_ready)
+		return ERROR_TIMEOUT_REACHED;
+
+	for (reg_id = 0; reg_id < (int)cache->num_regs; reg_id++) {
+		struct reg *r = &cache->reg_list[reg_id];
+
+		if (r->exist && r->size > 8)
+			r->dirty = false;
+	}
+
+	LOG_TARGET_DEBUG(target, "wrote %u 32-bit registers", wi);
+
+	return ERROR_OK;
+}
+
+/* Write back dirty registers, batched if the core keeps up */
+static void cortex_m_restore_context(struct target *target)
+{
+	struct cortex_m_common *cortex_m = target_to_cm(target);
+
+	if (!cortex_m->slow_register_read) {
+		if (cortex_m_fast_write_dirty_regs(target) == ERROR_TIMEOUT_REACHED)
+			LOG_TARGET_DEBUG(target, "Falling back to slow register write");
+	}
+
+	/* writes whatever is still dirty */
+	armv7m_restore_context(target);
+}
+
 static int cortex_m_write_debug_halt_mask(struct target *target,
 	uint32_t mask_on, uint32_t mask_off)
 {
@@ -788,6 +934,13 @@ static int cortex_m_debug_entry(struct target *target)
 	 * can pile up pending interrupts. */
 	cortex_m_set_maskints_for_halt(target);
 
+	/* Software breakpoints only live in memory while the core runs: take
+	 * them all out now, so removing and re-adding them while halted (as
+	 * GDB does on every stop) costs no target access at all. */
+	retval = cortex_m_update_soft_breakpoints(target, false);
+	if (retval != ERROR_OK && retval != ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
+		LOG_TARGET_WARNING(target, "failed to restore software breakpoints");
+
 	cortex_m_clear_halt(target);
 
 	retval = cortex_m_read_dhcsr_atomic_sticky(target);
@@ -1084,14 +1237,142 @@ static int cortex_m_soft_reset_halt(struct target *target)
 	return ERROR_OK;
 }
 
+/**
+ * Insert (@a set true) or restore all software breakpoints that are not yet
+ * in the requested state with one queued read and one queued write pass
+ * over the debug AP, instead of a read and a write transaction for each.
+ * Halfword breakpoints are patched into aligned words, breakpoints that
+ * share a word are merged before it is written back.
+ */
+static int cortex_m_update_soft_breakpoints(struct target *target, bool set)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	struct breakpoint *breakpoint;
+	unsigned int count = 0;
+	int retval;
+
+	if (!armv7m->debug_ap)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	for (breakpoint = target->breakpoints; breakpoint; breakpoint = breakpoint->next) {
+		if (breakpoint->type != BKPT_SOFT || breakpoint->is_set == set)
+			continue;
+		if (breakpoint->length != 2)
+			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		count++;
+	}
+	if (count == 0)
+		return ERROR_OK;
+
+	struct cortex_m_bkpt_word {
+		uint32_t address;
+		uint32_t orig;
+		uint32_t value;
+	} *words = malloc(count * sizeof(*words));
+	if (!words)
+		return ERROR_FAIL;
+
+	/* queue a read of every word that holds a breakpoint */
+	unsigned int num_words = 0;
+	for (breakpoint = target->breakpoints; breakpoint; breakpoint = breakpoint->next) {
+		if (breakpoint->type != BKPT_SOFT || breakpoint->is_set == set)
+			continue;
+		uint32_t address = breakpoint->address & ~3;
+		unsigned int i;
+		for (i = 0; i < num_words && words[i].address != address; i++)
+			;
+		if (i < num_words)
+			continue;
+		words[num_words].address = address;
+		retval = mem_ap_read_u32(armv7m->debug_ap, address, &words[num_words].value);
+		if (retval != ERROR_OK)
+			goto done;
+		num_words++;
+	}
+
+	retval = dap_run(armv7m->debug_ap->dap);
+	if (retval != ERROR_OK)
+		goto done;
+
+	for (unsigned int i = 0; i < num_words; i++)
+		words[i].orig = words[i].value;
+
+	/* NOTE: on ARMv6-M and ARMv7-M, BKPT(0xab) is used for
+	 * semihosting; don't use that.  Otherwise the BKPT
+	 * parameter is arbitrary.
+	 */
+	uint32_t bkpt = ARMV5_T_BKPT(0x11) & 0xffff;
+
+	for (breakpoint = target->breakpoints; breakpoint; breakpoint = breakpoint->next) {
+		if (breakpoint->type != BKPT_SOFT || breakpoint->is_set == set)
+			continue;
+		unsigned int i;
+		for (i = 0; words[i].address != (breakpoint->address & ~3); i++)
+			;
+		unsigned int shift = (breakpoint->address & 2) * 8;
+		uint32_t value = words[i].value & ~(0xffffu << shift);
+		if (set) {
+			/* bytes in memory order, same as a byte wise read */
+			breakpoint->orig_instr[0] = words[i].value >> shift;
+			breakpoint->orig_instr[1] = words[i].value >> (shift + 8);
+			value |= bkpt << shift;
+		} else {
+			value |= (uint32_t)le_to_h_u16(breakpoint->orig_instr) << shift;
+		}
+		words[i].value = value;
+	}
+
+	for (unsigned int i = 0; i < num_words; i++) {
+		retval = mem_ap_write_u32(armv7m->debug_ap, words[i].address, words[i].value);
+		if (retval != ERROR_OK)
+			goto done;
+	}
+
+	retval = dap_run(armv7m->debug_ap->dap);
+	if (retval != ERROR_OK) {
+		/* some words may have been written: put back what was read, so
+		 * the one by one fallback doesn't take a BKPT for the original
+		 * instruction */
+		for (unsigned int i = 0; i < num_words; i++)
+			mem_ap_write_u32(armv7m->debug_ap, words[i].address, words[i].orig);
+		dap_run(armv7m->debug_ap->dap);
+		goto done;
+	}
+
+	for (breakpoint = target->breakpoints; breakpoint; breakpoint = breakpoint->next)
+		if (breakpoint->type == BKPT_SOFT)
+			breakpoint->is_set = set;
+
+	LOG_TARGET_DEBUG(target, "%s %u software breakpoints in %u words",
+		set ? "set" : "restored", count, num_words);
+
+done:
+	free(words);
+	return retval;
+}
+
 void cortex_m_enable_breakpoints(struct target *target)
 {
 	struct breakpoint *breakpoint = target->breakpoints;
+	int retval;
+
+	/* software breakpoints go in as one batch, whatever fails there
+	 * is retried one by one below */
+	retval = cortex_m_update_soft_breakpoints(target, true);
+	if (retval != ERROR_OK && retval != ERROR_TARGET_RESOURCE_NOT_AVAILABLE)
+		LOG_TARGET_WARNING(target, "failed to insert software breakpoints in one batch, "
+			"retrying one by one");
 
 	/* set any pending breakpoints */
 	while (breakpoint) {
-		if (!breakpoint->is_set)
-			cortex_m_set_breakpoint(target, breakpoint);
+		if (!breakpoint->is_set) {
+			retval = cortex_m_set_breakpoint(target, breakpoint);
+			if (retval != ERROR_OK)
+				LOG_TARGET_ERROR(target, "failed to set %s breakpoint at " TARGET_ADDR_FMT
+					", it will not be hit",
+					breakpoint->type == BKPT_SOFT ? "software" : "hardware",
+					breakpoint->address);
+		}
 		breakpoint = breakpoint->next;
 	}
 }
@@ -1162,7 +1443,7 @@ static int cortex_m_resume(struct target *target, int current,
 
 	resume_pc = buf_get_u32(r->value, 0, 32);
 
-	armv7m_restore_context(target);
+	cortex_m_restore_context(target);
 
 	/* the front-end may request us not to handle breakpoints */
 	if (handle_breakpoints) {
@@ -1229,7 +1510,7 @@ static int cortex_m_step(struct target *target, int current,
 	/* the front-end may request us not to handle breakpoints */
 	if (handle_breakpoints) {
 		breakpoint = breakpoint_find(target, pc_value);
-		if (breakpoint)
+		if (breakpoint && breakpoint->is_set)
 			cortex_m_unset_breakpoint(target, breakpoint);
 	}
 
@@ -1237,7 +1518,7 @@ static int cortex_m_step(struct target *target, int current,
 
 	target->debug_reason = DBG_REASON_SINGLESTEP;
 
-	armv7m_restore_context(target);
+	cortex_m_restore_context(target);
 
 	target_call_event_callbacks(target, TARGET_EVENT_RESUMED);
 
@@ -1304,6 +1585,12 @@ static int cortex_m_step(struct target *target, int current,
 						type = BKPT_SOFT;
 					}
 					retval = breakpoint_add(target, pc_value, 2, type);
+					if (retval == ERROR_OK && type == BKPT_SOFT) {
+						/* software breakpoints added while halted wait for resume */
+						struct breakpoint *tmp_bp = breakpoint_find(target, pc_value);
+						if (tmp_bp && !tmp_bp->is_set)
+							retval = cortex_m_set_breakpoint(target, tmp_bp);
+					}
 				}
 
 				bool tmp_bp_set = (retval == ERROR_OK);
@@ -1316,6 +1603,10 @@ static int cortex_m_step(struct target *target, int current,
 					cortex_m_write_debug_halt_mask(target, C_HALT, 0);
 					cortex_m_set_maskints_for_halt(target);
 				} else {
+					/* software breakpoints are kept out of memory while
+					 * halted, the handlers may hit them */
+					cortex_m_enable_breakpoints(target);
+
 					/* Start the core */
 					LOG_TARGET_DEBUG(target, "Starting core to serve pending interrupts");
 					int64_t t_start = timeval_ms();
@@ -1709,6 +2000,22 @@ int cortex_m_add_breakpoint(struct target *target, struct breakpoint *breakpoint
 		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
 	}
 
+	/* while halted, software breakpoints are inserted in one batch on
+	 * resume; writing the original halfword back now reports memory
+	 * that can't take a breakpoint when it is added, not on resume */
+	if (breakpoint->type == BKPT_SOFT && target->state == TARGET_HALTED &&
+			target_to_armv7m(target)->debug_ap) {
+		target_addr_t address = breakpoint->address & 0xFFFFFFFE;
+		uint8_t probe[2];
+		int retval = target_read_memory(target, address, breakpoint->length, 1, probe);
+		if (retval == ERROR_OK)
+			retval = target_write_memory(target, address, breakpoint->length, 1, probe);
+		if (retval != ERROR_OK)
+			LOG_TARGET_ERROR(target, "can't access memory for software breakpoint at "
+				TARGET_ADDR_FMT, breakpoint->address);
+		return retval;
+	}
+
 	return cortex_m_set_breakpoint(target, breakpoint);
 }
 
@@ -1994,11 +2301,15 @@ void cortex_m_deinit_target(struct target *target)
 	free(cortex_m);
 }
 
-int cortex_m_profiling(struct target *target, uint32_t *samples,
-			      uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+/* PCSR samples per no-increment block read, and per batch of single reads
+ * when there is no MEM-AP to do block reads with (hla) */
+#define CORTEX_M_PCSR_BATCH		1024
+#define CORTEX_M_PCSR_SINGLE_BATCH	64
+
+/* Check that DWT_PCSR works and get the target running. Returns
+ * ERROR_NOT_IMPLEMENTED if PCSR sampling is unsupported. */
+static int cortex_m_profiling_start(struct target *target)
 {
-	struct timeval timeout, now;
-	struct armv7m_common *armv7m = target_to_armv7m(target);
 	uint32_t reg_value;
 	int retval;
 
@@ -2009,12 +2320,9 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 	}
 	if (reg_value == 0) {
 		LOG_TARGET_INFO(target, "PCSR sampling not supported on this processor.");
-		return target_profiling_default(target, samples, max_num_samples, num_samples, seconds);
+		return ERROR_NOT_IMPLEMENTED;
 	}
 
-	gettimeofday(&timeout, NULL);
-	timeval_add_time(&timeout, seconds, 0);
-
 	LOG_TARGET_INFO(target, "Starting Cortex-M profiling. Sampling DWT_PCSR as fast as we can...");
 
 	/* Make sure the target is running */
@@ -2022,32 +2330,61 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 	if (target->state == TARGET_HALTED)
 		retval = target_resume(target, 1, 0, 0, 0);
 
-	if (retval != ERROR_OK) {
+	if (retval != ERROR_OK)
 		LOG_TARGET_ERROR(target, "Error while resuming target");
-		return retval;
+	return retval;
+}
+
+/* Fill 'samples' with up to 'max_num_samples' PCSR values, returns the number
+ * read in 'num_samples'. */
+static int cortex_m_read_pcsr(struct target *target, uint32_t *samples,
+		uint32_t max_num_samples, uint32_t *num_samples)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+	int retval = ERROR_OK;
+
+	if (armv7m && armv7m->debug_ap) {
+		uint32_t read_count = MIN(max_num_samples, CORTEX_M_PCSR_BATCH);
+
+		retval = mem_ap_read_buf_noincr(armv7m->debug_ap,
+					(void *)samples, 4, read_count, DWT_PCSR);
+		*num_samples = read_count;
+	} else {
+		uint32_t read_count = MIN(max_num_samples, CORTEX_M_PCSR_SINGLE_BATCH);
+
+		for (*num_samples = 0; retval == ERROR_OK && *num_samples < read_count; (*num_samples)++)
+			retval = target_read_u32(target, DWT_PCSR, &samples[*num_samples]);
 	}
 
+	if (retval != ERROR_OK)
+		LOG_TARGET_ERROR(target, "Error while reading PCSR");
+	return retval;
+}
+
+int cortex_m_profiling(struct target *target, uint32_t *samples,
+			      uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds)
+{
+	struct timeval timeout, now;
+	int retval;
+
+	retval = cortex_m_profiling_start(target);
+	if (retval == ERROR_NOT_IMPLEMENTED)
+		return target_profiling_default(target, samples, max_num_samples, num_samples, seconds);
+	if (retval != ERROR_OK)
+		return retval;
+
+	gettimeofday(&timeout, NULL);
+	timeval_add_time(&timeout, seconds, 0);
+
 	uint32_t sample_count = 0;
 
 	for (;;) {
-		if (armv7m && armv7m->debug_ap) {
-			uint32_t read_count = max_num_samples - sample_count;
-			if (read_count > 1024)
-				read_count = 1024;
-
-			retval = mem_ap_read_buf_noincr(armv7m->debug_ap,
-						(void *)&samples[sample_count],
-						4, read_count, DWT_PCSR);
-			sample_count += read_count;
-		} else {
-			target_read_u32(target, DWT_PCSR, &samples[sample_count++]);
-		}
-
-		if (retval != ERROR_OK) {
-			LOG_TARGET_ERROR(target, "Error while reading PCSR");
+		uint32_t read_count;
+		retval = cortex_m_read_pcsr(target, &samples[sample_count],
+				max_num_samples - sample_count, &read_count);
+		if (retval != ERROR_OK)
 			return retval;
-		}
-
+		sample_count += read_count;
 
 		gettimeofday(&now, NULL);
 		if (sample_count >= max_num_samples || timeval_compare(&now, &timeout) > 0) {
@@ -2060,6 +2397,43 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 	return retval;
 }
 
+int cortex_m_profiling_stream(struct target *target,
+		int (*callback)(struct target *target, const uint32_t *samples,
+			uint32_t num_samples, void *priv),
+		void *priv, uint32_t seconds)
+{
+	struct timeval timeout, now;
+	uint32_t samples[CORTEX_M_PCSR_BATCH];
+	uint64_t sample_count = 0;
+	int retval;
+
+	retval = cortex_m_profiling_start(target);
+	if (retval != ERROR_OK)
+		return retval;
+
+	gettimeofday(&timeout, NULL);
+	timeval_add_time(&timeout, seconds, 0);
+
+	for (;;) {
+		uint32_t num_samples;
+		retval = cortex_m_read_pcsr(target, samples, ARRAY_SIZE(samples), &num_samples);
+		if (retval != ERROR_OK)
+			return retval;
+
+		retval = callback(target, samples, num_samples, priv);
+		if (retval != ERROR_OK)
+			return retval;
+		sample_count += num_samples;
+
+		gettimeofday(&now, NULL);
+		if (timeval_compare(&now, &timeout) > 0) {
+			LOG_TARGET_INFO(target, "Profiling completed. %" PRIu64 " samples.", sample_count);
+			break;
+		}
+	}
+
+	return retval;
+}
 
 /* REVISIT cache valid/dirty bits are unmaintained.  We could set "valid"
  * on r/w if the core is not running, and clear on resume or reset ... or
@@ -2861,4 +3235,5 @@ struct target_type cortexm_target = {
 	.deinit_target = cortex_m_deinit_target,
 
 	.profiling = cortex_m_profiling,
+	.profiling_stream = cortex_m_profiling_stream,
 };
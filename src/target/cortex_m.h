@@ -324,5 +324,9 @@ void cortex_m_enable_watchpoints(struct target *target);
 void cortex_m_deinit_target(struct target *target);
 int cortex_m_profiling(struct target *target, uint32_t *samples,
 	uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
+int cortex_m_profiling_stream(struct target *target,
+	int (*callback)(struct target *target, const uint32_t *samples,
+		uint32_t num_samples, void *priv),
+	void *priv, uint32_t seconds);
 
 #endif /* OPENOCD_TARGET_CORTEX_M_H */
@@ -122,239 +122,238 @@ static int identify_image_type(struct image *image, const char *type_string, con
 	return ERROR_OK;
 }
 
-static int image_ihex_buffer_complete_inner(struct image *image,
-	char *lpsz_line,
-	struct imagesection *section)
+/* Value of a hex digit, or -1 */
+static inline int image_hex_nibble(char c)
 {
-	struct image_ihex *ihex = image->type_private;
-	struct fileio *fileio = ihex->fileio;
-	uint32_t full_address;
-	uint32_t cooked_bytes;
-	bool end_rec = false;
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
 
-	/* we can't determine the number of sections that we'll have to create ahead of time,
-	 * so we locally hold them until parsing is finished */
+/**
+ * Decode @a count bytes of hex text into @a out and add them to @a sum.
+ * Eight digits are validated and converted per step with SWAR arithmetic
+ * on a 64-bit word, the tail is done digit by digit.
+ *
+ * @returns false if the text contains a character that is not a hex digit
+ */
+static bool image_hex_decode(const char *text, uint8_t *out, uint32_t count, uint8_t *sum)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t high = 0x8080808080808080ULL;
+	const uint64_t lanes = 0x00FF00FF00FF00FFULL;
+	uint8_t s = *sum;
+
+	for (; count >= 4; count -= 4, text += 8, out += 4) {
+		uint64_t x = le_to_h_u64((const uint8_t *)text);
+		uint64_t lower = x | (0x20 * ones);
+
+		/* the high bit of each byte flags '0'..'9' resp. 'a'..'f' */
+		uint64_t digit = ((x | high) - '0' * ones) & (('9' * ones | high) - x);
+		uint64_t alpha = ((lower | high) - 'a' * ones) & (('f' * ones | high) - lower);
+		if ((x & high) || ((digit | alpha) & high) != high)
+			return false;
+
+		/* nibble values, then merge digit pairs into bytes */
+		uint64_t v = (x & (0x0F * ones)) + 9 * ((alpha & high) >> 7);
+		v = ((v & lanes) << 4) | ((v >> 8) & lanes);
+		v = (v | (v >> 8)) & 0x0000FFFF0000FFFFULL;
+		v = (v | (v >> 16)) & 0xFFFFFFFFULL;
+
+		h_u32_to_le(out, v);
+		s += v + (v >> 8) + (v >> 16) + (v >> 24);
+	}
 
-	size_t filesize;
-	int retval;
-	retval = fileio_size(fileio, &filesize);
-	if (retval != ERROR_OK)
-		return retval;
+	for (; count > 0; count--, text += 2, out++) {
+		int hi = image_hex_nibble(text[0]);
+		int lo = image_hex_nibble(text[1]);
+		if (hi < 0 || lo < 0)
+			return false;
+		*out = (hi << 4) | lo;
+		s += *out;
+	}
 
-	ihex->buffer = malloc(filesize >> 1);
-	cooked_bytes = 0x0;
-	image->num_sections = 0;
+	*sum = s;
+	return true;
+}
 
-	while (!fileio_feof(fileio)) {
-		full_address = 0x0;
-		section[image->num_sections].private = &ihex->buffer[cooked_bytes];
-		section[image->num_sections].base_address = 0x0;
-		section[image->num_sections].size = 0x0;
-		section[image->num_sections].flags = 0;
-
-		while (fileio_fgets(fileio, 1023, lpsz_line) == ERROR_OK) {
-			uint32_t count;
-			uint32_t address;
-			uint32_t record_type;
-			uint32_t checksum;
-			uint8_t cal_checksum = 0;
-			size_t bytes_read = 0;
-
-			/* skip comments and blank lines */
-			if ((lpsz_line[0] == '#') || (strlen(lpsz_line + strspn(lpsz_line, "\n\t\r ")) == 0))
-				continue;
-
-			if (sscanf(&lpsz_line[bytes_read], ":%2" SCNx32 "%4" SCNx32 "%2" SCNx32, &count,
-				&address, &record_type) != 3)
-				return ERROR_IMAGE_FORMAT_ERROR;
-			bytes_read += 9;
-
-			cal_checksum += (uint8_t)count;
-			cal_checksum += (uint8_t)(address >> 8);
-			cal_checksum += (uint8_t)address;
-			cal_checksum += (uint8_t)record_type;
-
-			if (record_type == 0) {	/* Data Record */
-				if ((full_address & 0xffff) != address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff0000) | address;
-					full_address = (full_address & 0xffff0000) | address;
-				}
+/* Next record of a text image with surrounding blanks and the line ending
+ * removed, comments and blank lines are skipped */
+static const char *image_text_next_line(const char **pos, const char *end, size_t *len)
+{
+	while (*pos < end) {
+		const char *line = *pos;
+		const char *eol = memchr(line, '\n', end - line);
 
-				while (count-- > 0) {
-					unsigned value;
-					sscanf(&lpsz_line[bytes_read], "%2x", &value);
-					ihex->buffer[cooked_bytes] = (uint8_t)value;
-					cal_checksum += (uint8_t)ihex->buffer[cooked_bytes];
-					bytes_read += 2;
-					cooked_bytes += 1;
-					section[image->num_sections].size += 1;
-					full_address++;
-				}
-			} else if (record_type == 1) {	/* End of File Record */
-				/* finish the current section */
-				image->num_sections++;
-
-				/* copy section information */
-				image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
-				for (unsigned int i = 0; i < image->num_sections; i++) {
-					image->sections[i].private = section[i].private;
-					image->sections[i].base_address = section[i].base_address;
-					image->sections[i].size = section[i].size;
-					image->sections[i].flags = section[i].flags;
-				}
+		*pos = eol ? eol + 1 : end;
+		if (!eol)
+			eol = end;
 
-				end_rec = true;
-				break;
-			} else if (record_type == 2) {	/* Linear Address Record */
-				uint16_t upper_address;
-
-				sscanf(&lpsz_line[bytes_read], "%4hx", &upper_address);
-				cal_checksum += (uint8_t)(upper_address >> 8);
-				cal_checksum += (uint8_t)upper_address;
-				bytes_read += 4;
-
-				if ((full_address >> 4) != upper_address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff) | (upper_address << 4);
-					full_address = (full_address & 0xffff) | (upper_address << 4);
-				}
-			} else if (record_type == 3) {	/* Start Segment Address Record */
-				uint32_t dummy;
-
-				/* "Start Segment Address Record" will not be supported
-				 * but we must consume it, and do not create an error.  */
-				while (count-- > 0) {
-					sscanf(&lpsz_line[bytes_read], "%2" SCNx32, &dummy);
-					cal_checksum += (uint8_t)dummy;
-					bytes_read += 2;
-				}
-			} else if (record_type == 4) {	/* Extended Linear Address Record */
-				uint16_t upper_address;
-
-				sscanf(&lpsz_line[bytes_read], "%4hx", &upper_address);
-				cal_checksum += (uint8_t)(upper_address >> 8);
-				cal_checksum += (uint8_t)upper_address;
-				bytes_read += 4;
-
-				if ((full_address >> 16) != upper_address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						if (image->num_sections >= IMAGE_MAX_SECTIONS) {
-							/* too many sections */
-							LOG_ERROR("Too many sections found in IHEX file");
-							return ERROR_IMAGE_FORMAT_ERROR;
-						}
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address =
-						(full_address & 0xffff) | (upper_address << 16);
-					full_address = (full_address & 0xffff) | (upper_address << 16);
-				}
-			} else if (record_type == 5) {	/* Start Linear Address Record */
-				uint32_t start_address;
-
-				sscanf(&lpsz_line[bytes_read], "%8" SCNx32, &start_address);
-				cal_checksum += (uint8_t)(start_address >> 24);
-				cal_checksum += (uint8_t)(start_address >> 16);
-				cal_checksum += (uint8_t)(start_address >> 8);
-				cal_checksum += (uint8_t)start_address;
-				bytes_read += 8;
-
-				image->start_address_set = true;
-				image->start_address = be_to_h_u32((uint8_t *)&start_address);
-			} else {
-				LOG_ERROR("unhandled IHEX record type: %i", (int)record_type);
-				return ERROR_IMAGE_FORMAT_ERROR;
-			}
+		while (line < eol && isspace((unsigned char)*line))
+			line++;
+		while (eol > line && isspace((unsigned char)eol[-1]))
+			eol--;
 
-			sscanf(&lpsz_line[bytes_read], "%2" SCNx32, &checksum);
+		if (line == eol || *line == '#')
+			continue;
 
-			if ((uint8_t)checksum != (uint8_t)(~cal_checksum + 1)) {
-				/* checksum failed */
-				LOG_ERROR("incorrect record checksum found in IHEX file");
-				return ERROR_IMAGE_CHECKSUM;
-			}
+		*len = eol - line;
+		return line;
+	}
 
-			if (end_rec) {
-				end_rec = false;
-				LOG_WARNING("continuing after end-of-file record: %.40s", lpsz_line);
-			}
+	return NULL;
+}
+
+static void image_text_init_section(struct imagesection *section, uint8_t *data)
+{
+	section->private = data;
+	section->base_address = 0x0;
+	section->size = 0x0;
+	section->flags = 0;
+}
+
+/* Continue at @a base: a nonconsecutive location creates a new section,
+ * unless the current section has zero size, in which case this specifies
+ * the current section's base address */
+static int image_text_new_section(struct image *image, struct imagesection *section,
+		uint8_t *data, target_addr_t base)
+{
+	if (section[image->num_sections].size != 0) {
+		if (image->num_sections + 1 >= IMAGE_MAX_SECTIONS) {
+			/* too many sections */
+			LOG_ERROR("Too many sections found in image file");
+			return ERROR_IMAGE_FORMAT_ERROR;
 		}
+		image->num_sections++;
+		image_text_init_section(&section[image->num_sections], data);
 	}
+	section[image->num_sections].base_address = base;
 
-	if (end_rec)
-		return ERROR_OK;
-	else {
-		LOG_ERROR("premature end of IHEX file, no matching end-of-file record found");
-		return ERROR_IMAGE_FORMAT_ERROR;
+	return ERROR_OK;
+}
+
+/* Close the current section at an end-of-file record, empty ones are dropped */
+static int image_text_end_section(struct image *image, struct imagesection *section,
+		uint8_t *data)
+{
+	if (section[image->num_sections].size != 0) {
+		if (image->num_sections + 1 >= IMAGE_MAX_SECTIONS) {
+			/* too many sections */
+			LOG_ERROR("Too many sections found in image file");
+			return ERROR_IMAGE_FORMAT_ERROR;
+		}
+		image->num_sections++;
 	}
+	image_text_init_section(&section[image->num_sections], data);
+
+	return ERROR_OK;
 }
 
 /**
- * Allocate memory dynamically instead of on the stack. This
- * is important w/embedded hosts.
+ * Single pass Intel HEX parser. Records are decoded in place, data goes
+ * straight into @a buffer and consecutive records are coalesced into one
+ * section. @a section holds IMAGE_MAX_SECTIONS entries of scratch space.
  */
-static int image_ihex_buffer_complete(struct image *image)
+static int image_ihex_parse(struct image *image, const char *text, size_t text_size,
+		uint8_t *buffer, struct imagesection *section)
 {
-	char *lpsz_line = malloc(1023);
-	if (!lpsz_line) {
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
-	struct imagesection *section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
-	if (!section) {
-		free(lpsz_line);
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
-	}
+	const char *pos = text;
+	const char *end = text + text_size;
+	const char *line;
+	size_t len;
+	uint32_t full_address = 0x0;
+	uint32_t cooked_bytes = 0x0;
+	bool end_rec = false;
 	int retval;
 
-	retval = image_ihex_buffer_complete_inner(image, lpsz_line, section);
+	image->num_sections = 0;
+	image_text_init_section(&section[0], buffer);
+
+	while ((line = image_text_next_line(&pos, end, &len))) {
+		uint8_t record[4 + 255 + 1];
+		uint8_t cal_checksum = 0;
+
+		if (len < 11 || line[0] != ':' ||
+				!image_hex_decode(line + 1, record, 4, &cal_checksum))
+			return ERROR_IMAGE_FORMAT_ERROR;
+
+		uint32_t count = record[0];
+		uint32_t address = (record[1] << 8) | record[2];
+		uint32_t record_type = record[3];
+		uint8_t *data = (record_type == 0) ? &buffer[cooked_bytes] : &record[4];
+
+		if (len < 11 + 2 * count ||
+				!image_hex_decode(line + 9, data, count, &cal_checksum) ||
+				!image_hex_decode(line + 9 + 2 * count, &record[4 + 255], 1, &cal_checksum))
+			return ERROR_IMAGE_FORMAT_ERROR;
+
+		if (cal_checksum != 0) {
+			/* checksum failed */
+			LOG_ERROR("incorrect record checksum found in IHEX file");
+			return ERROR_IMAGE_CHECKSUM;
+		}
 
-	free(section);
-	free(lpsz_line);
+		if (end_rec) {
+			end_rec = false;
+			LOG_WARNING("continuing after end-of-file record: %.40s", line);
+		}
 
-	return retval;
+		if (record_type == 0) {	/* Data Record */
+			if ((full_address & 0xffff) != address) {
+				full_address = (full_address & 0xffff0000) | address;
+				retval = image_text_new_section(image, section, data, full_address);
+				if (retval != ERROR_OK)
+					return retval;
+			}
+
+			cooked_bytes += count;
+			section[image->num_sections].size += count;
+			full_address += count;
+		} else if (record_type == 1) {	/* End of File Record */
+			retval = image_text_end_section(image, section, &buffer[cooked_bytes]);
+			if (retval != ERROR_OK)
+				return retval;
+			full_address = 0x0;
+			end_rec = true;
+		} else if (record_type == 2 || record_type == 4) {
+			/* (Extended) Segment / Linear Address Record */
+			if (count < 2)
+				return ERROR_IMAGE_FORMAT_ERROR;
+
+			uint32_t upper_address = (record[4] << 8) | record[5];
+			unsigned int shift = (record_type == 2) ? 4 : 16;
+
+			if ((full_address >> shift) != upper_address) {
+				full_address = (full_address & 0xffff) | (upper_address << shift);
+				retval = image_text_new_section(image, section,
+						&buffer[cooked_bytes], full_address);
+				if (retval != ERROR_OK)
+					return retval;
+			}
+		} else if (record_type == 3) {	/* Start Segment Address Record */
+			/* "Start Segment Address Record" will not be supported
+			 * but we must consume it, and do not create an error.  */
+		} else if (record_type == 5) {	/* Start Linear Address Record */
+			if (count < 4)
+				return ERROR_IMAGE_FORMAT_ERROR;
+
+			image->start_address_set = true;
+			image->start_address = be_to_h_u32(&record[4]);
+		} else {
+			LOG_ERROR("unhandled IHEX record type: %i", (int)record_type);
+			return ERROR_IMAGE_FORMAT_ERROR;
+		}
+	}
+
+	if (!end_rec) {
+		LOG_ERROR("premature end of IHEX file, no matching end-of-file record found");
+		return ERROR_IMAGE_FORMAT_ERROR;
+	}
+
+	return ERROR_OK;
 }
 
 static int image_elf32_read_headers(struct image *image)
@@ -747,6 +746,13 @@ static int image_elf_read_section(struct image *image,
 	size_t *size_read)
 {
 	struct image_elf *elf = image->type_private;
+	const uint8_t *data;
+
+	if (image_map_section(image, section, offset, size, &data) == ERROR_OK) {
+		memcpy(buffer, data, size);
+		*size_read = size;
+		return ERROR_OK;
+	}
 
 	if (elf->is_64_bit)
 		return image_elf64_read_section(image, section, offset, size, buffer, size_read);
@@ -754,206 +760,300 @@ static int image_elf_read_section(struct image *image,
 		return image_elf32_read_section(image, section, offset, size, buffer, size_read);
 }
 
-static int image_mot_buffer_complete_inner(struct image *image,
-	char *lpsz_line,
-	struct imagesection *section)
+/**
+ * Single pass Motorola S-record parser, see image_ihex_parse().
+ */
+static int image_mot_parse(struct image *image, const char *text, size_t text_size,
+		uint8_t *buffer, struct imagesection *section)
 {
-	struct image_mot *mot = image->type_private;
-	struct fileio *fileio = mot->fileio;
-	uint32_t full_address;
-	uint32_t cooked_bytes;
+	const char *pos = text;
+	const char *end = text + text_size;
+	const char *line;
+	size_t len;
+	uint32_t full_address = 0x0;
+	uint32_t cooked_bytes = 0x0;
 	bool end_rec = false;
-
-	/* we can't determine the number of sections that we'll have to create ahead of time,
-	 * so we locally hold them until parsing is finished */
-
 	int retval;
-	size_t filesize;
-	retval = fileio_size(fileio, &filesize);
-	if (retval != ERROR_OK)
-		return retval;
 
-	mot->buffer = malloc(filesize >> 1);
-	cooked_bytes = 0x0;
 	image->num_sections = 0;
+	image_text_init_section(&section[0], buffer);
+
+	while ((line = image_text_next_line(&pos, end, &len))) {
+		uint8_t record[4 + 255];
+		uint8_t count, checksum;
+		uint8_t cal_checksum = 0;
+
+		/* get record type and record length */
+		int record_type = (len >= 4 && line[0] == 'S') ? image_hex_nibble(line[1]) : -1;
+		if (record_type < 0 || record_type > 9 ||
+				!image_hex_decode(line + 2, &count, 1, &cal_checksum) ||
+				count < 1 || len < 4 + 2 * (size_t)count)
+			return ERROR_IMAGE_FORMAT_ERROR;
+
+		/* address width of S1/S9, S2/S8 and S3/S7 records */
+		uint32_t address_bytes = 0;
+		if (record_type >= 1 && record_type <= 3)
+			address_bytes = record_type + 1;
+		else if (record_type >= 7)
+			address_bytes = 11 - record_type;
+
+		/* count covers address, data and the checksum byte */
+		if (count < address_bytes + 1)
+			return ERROR_IMAGE_FORMAT_ERROR;
+		uint32_t data_bytes = count - address_bytes - 1;
+
+		const char *digits = line + 4;
+		uint8_t *data = (record_type >= 1 && record_type <= 3) ? &buffer[cooked_bytes] : &record[4];
+		if (!image_hex_decode(digits, record, address_bytes, &cal_checksum) ||
+				!image_hex_decode(digits + 2 * address_bytes, data, data_bytes, &cal_checksum) ||
+				!image_hex_decode(digits + 2 * (count - 1), &checksum, 1, &cal_checksum))
+			return ERROR_IMAGE_FORMAT_ERROR;
+
+		/* the checksum is the ones' complement of the sum of the other bytes */
+		if (cal_checksum != 0xFF) {
+			/* checksum failed */
+			LOG_ERROR("incorrect record checksum found in S19 file");
+			return ERROR_IMAGE_CHECKSUM;
+		}
 
-	while (!fileio_feof(fileio)) {
-		full_address = 0x0;
-		section[image->num_sections].private = &mot->buffer[cooked_bytes];
-		section[image->num_sections].base_address = 0x0;
-		section[image->num_sections].size = 0x0;
-		section[image->num_sections].flags = 0;
-
-		while (fileio_fgets(fileio, 1023, lpsz_line) == ERROR_OK) {
-			uint32_t count;
-			uint32_t address;
-			uint32_t record_type;
-			uint32_t checksum;
-			uint8_t cal_checksum = 0;
-			uint32_t bytes_read = 0;
-
-			/* skip comments and blank lines */
-			if ((lpsz_line[0] == '#') || (strlen(lpsz_line + strspn(lpsz_line, "\n\t\r ")) == 0))
-				continue;
-
-			/* get record type and record length */
-			if (sscanf(&lpsz_line[bytes_read], "S%1" SCNx32 "%2" SCNx32, &record_type,
-				&count) != 2)
-				return ERROR_IMAGE_FORMAT_ERROR;
-
-			bytes_read += 4;
-			cal_checksum += (uint8_t)count;
-
-			/* skip checksum byte */
-			count -= 1;
-
-			if (record_type == 0) {
-				/* S0 - starting record (optional) */
-				int value;
+		if (end_rec) {
+			end_rec = false;
+			LOG_WARNING("continuing after end-of-file record: %.40s", line);
+		}
 
-				while (count-- > 0) {
-					sscanf(&lpsz_line[bytes_read], "%2x", &value);
-					cal_checksum += (uint8_t)value;
-					bytes_read += 2;
-				}
-			} else if (record_type >= 1 && record_type <= 3) {
-				switch (record_type) {
-					case 1:
-						/* S1 - 16 bit address data record */
-						sscanf(&lpsz_line[bytes_read], "%4" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 4;
-						count -= 2;
-						break;
-
-					case 2:
-						/* S2 - 24 bit address data record */
-						sscanf(&lpsz_line[bytes_read], "%6" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 16);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 6;
-						count -= 3;
-						break;
-
-					case 3:
-						/* S3 - 32 bit address data record */
-						sscanf(&lpsz_line[bytes_read], "%8" SCNx32, &address);
-						cal_checksum += (uint8_t)(address >> 24);
-						cal_checksum += (uint8_t)(address >> 16);
-						cal_checksum += (uint8_t)(address >> 8);
-						cal_checksum += (uint8_t)address;
-						bytes_read += 8;
-						count -= 4;
-						break;
+		if (record_type == 0 || record_type == 5 || record_type == 6) {
+			/* S0 - starting record (optional),
+			 * S5 and S6 are the data count records, we ignore them */
+		} else if (record_type >= 1 && record_type <= 3) {
+			/* S1, S2, S3 - 16, 24 and 32 bit address data records */
+			uint32_t address = 0;
+			for (uint32_t i = 0; i < address_bytes; i++)
+				address = (address << 8) | record[i];
+
+			if (full_address != address) {
+				full_address = address;
+				retval = image_text_new_section(image, section, data, full_address);
+				if (retval != ERROR_OK)
+					return retval;
+			}
 
-				}
+			cooked_bytes += data_bytes;
+			section[image->num_sections].size += data_bytes;
+			full_address += data_bytes;
+		} else if (record_type >= 7) {
+			/* S7, S8, S9 - ending records for 32, 24 and 16bit */
+			retval = image_text_end_section(image, section, &buffer[cooked_bytes]);
+			if (retval != ERROR_OK)
+				return retval;
+			full_address = 0x0;
+			end_rec = true;
+		} else {
+			LOG_ERROR("unhandled S19 record type: %i", record_type);
+			return ERROR_IMAGE_FORMAT_ERROR;
+		}
+	}
 
-				if (full_address != address) {
-					/* we encountered a nonconsecutive location, create a new section,
-					 * unless the current section has zero size, in which case this specifies
-					 * the current section's base address
-					 */
-					if (section[image->num_sections].size != 0) {
-						image->num_sections++;
-						section[image->num_sections].size = 0x0;
-						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&mot->buffer[cooked_bytes];
-					}
-					section[image->num_sections].base_address = address;
-					full_address = address;
-				}
+	if (!end_rec) {
+		LOG_ERROR("premature end of S19 file, no matching end-of-file record found");
+		return ERROR_IMAGE_FORMAT_ERROR;
+	}
 
-				while (count-- > 0) {
-					unsigned value;
-					sscanf(&lpsz_line[bytes_read], "%2x", &value);
-					mot->buffer[cooked_bytes] = (uint8_t)value;
-					cal_checksum += (uint8_t)mot->buffer[cooked_bytes];
-					bytes_read += 2;
-					cooked_bytes += 1;
-					section[image->num_sections].size += 1;
-					full_address++;
-				}
-			} else if (record_type == 5 || record_type == 6) {
-				/* S5 and S6 are the data count records, we ignore them */
-				uint32_t dummy;
-
-				while (count-- > 0) {
-					sscanf(&lpsz_line[bytes_read], "%2" SCNx32, &dummy);
-					cal_checksum += (uint8_t)dummy;
-					bytes_read += 2;
-				}
-			} else if (record_type >= 7 && record_type <= 9) {
-				/* S7, S8, S9 - ending records for 32, 24 and 16bit */
-				image->num_sections++;
-
-				/* copy section information */
-				image->sections = malloc(sizeof(struct imagesection) * image->num_sections);
-				for (unsigned int i = 0; i < image->num_sections; i++) {
-					image->sections[i].private = section[i].private;
-					image->sections[i].base_address = section[i].base_address;
-					image->sections[i].size = section[i].size;
-					image->sections[i].flags = section[i].flags;
-				}
+	return ERROR_OK;
+}
 
-				end_rec = true;
-				break;
-			} else {
-				LOG_ERROR("unhandled S19 record type: %i", (int)(record_type));
-				return ERROR_IMAGE_FORMAT_ERROR;
-			}
+/* With 'image_cache enable' the last ihex/S-record file parsed is kept
+ * decoded, so that opening the same contents again (e.g. 'program ... verify'
+ * reads the file once to write and once to verify) skips parsing. A copy of
+ * the text is kept as well: the size and CRC-32 only pick the candidate, the
+ * text itself must match. Files larger than IMAGE_TEXT_CACHE_MAX_SIZE are
+ * not kept. */
+#define IMAGE_TEXT_CACHE_MAX_SIZE	(16 * 1024 * 1024)
+
+static bool image_text_cache_enabled;
+
+static struct {
+	enum image_type type;
+	size_t text_size;
+	uint32_t text_crc;
+	uint8_t *text;
+	uint8_t *buffer;
+	size_t buffer_size;
+	unsigned int num_sections;
+	struct imagesection *sections;
+	bool start_address_set;
+	uint32_t start_address;
+} image_text_cache;
+
+void image_free_cache(void)
+{
+	free(image_text_cache.text);
+	free(image_text_cache.buffer);
+	free(image_text_cache.sections);
+	memset(&image_text_cache, 0, sizeof(image_text_cache));
+}
 
-			/* account for checksum, will always be 0xFF */
-			sscanf(&lpsz_line[bytes_read], "%2" SCNx32, &checksum);
-			cal_checksum += (uint8_t)checksum;
+bool image_get_cache_enabled(void)
+{
+	return image_text_cache_enabled;
+}
 
-			if (cal_checksum != 0xFF) {
-				/* checksum failed */
-				LOG_ERROR("incorrect record checksum found in S19 file");
-				return ERROR_IMAGE_CHECKSUM;
-			}
+void image_set_cache_enabled(bool enable)
+{
+	image_text_cache_enabled = enable;
+	if (!enable)
+		image_free_cache();
+}
 
-			if (end_rec) {
-				end_rec = false;
-				LOG_WARNING("continuing after end-of-file record: %.40s", lpsz_line);
-			}
-		}
+/* Duplicate a decoded buffer and its section table, the section data
+ * pointers are rebased onto the new buffer */
+static int image_text_copy(uint8_t **to_buffer, struct imagesection **to_sections,
+		const uint8_t *from_buffer, const struct imagesection *from_sections,
+		size_t buffer_size, unsigned int num_sections)
+{
+	uint8_t *buffer = malloc(buffer_size ? buffer_size : 1);
+	struct imagesection *sections = malloc(sizeof(*sections) * (num_sections ? num_sections : 1));
+	if (!buffer || !sections) {
+		free(buffer);
+		free(sections);
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
 	}
 
-	if (end_rec)
-		return ERROR_OK;
-	else {
-		LOG_ERROR("premature end of S19 file, no matching end-of-file record found");
-		return ERROR_IMAGE_FORMAT_ERROR;
+	memcpy(buffer, from_buffer, buffer_size);
+	for (unsigned int i = 0; i < num_sections; i++) {
+		sections[i] = from_sections[i];
+		sections[i].private = buffer + ((const uint8_t *)from_sections[i].private - from_buffer);
 	}
+
+	*to_buffer = buffer;
+	*to_sections = sections;
+	return ERROR_OK;
 }
 
 /**
- * Allocate memory dynamically instead of on the stack. This
- * is important w/embedded hosts.
+ * Read an ihex or S-record file and decode it. The text is taken from the
+ * file mapping when there is one, the decoded data ends up in @a buffer.
  */
-static int image_mot_buffer_complete(struct image *image)
+static int image_text_buffer_complete(struct image *image, struct fileio *fileio,
+		uint8_t **buffer)
 {
-	char *lpsz_line = malloc(1023);
-	if (!lpsz_line) {
-		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
+	const uint8_t *text;
+	uint8_t *text_copy = NULL;
+	size_t text_size;
+	uint32_t text_crc = 0;
+	struct imagesection *section = NULL;
+	int retval;
+
+	*buffer = NULL;
+
+	retval = fileio_size(fileio, &text_size);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (fileio_map(fileio, 0, text_size, &text) != ERROR_OK) {
+		size_t size_read;
+
+		text_copy = malloc(text_size + 1);
+		if (!text_copy) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		retval = fileio_read(fileio, text_size, text_copy, &size_read);
+		if (retval == ERROR_OK && size_read != text_size)
+			retval = ERROR_FILEIO_OPERATION_FAILED;
+		if (retval != ERROR_OK) {
+			free(text_copy);
+			return retval;
+		}
+		text = text_copy;
+	}
+
+	if (image_text_cache_enabled) {
+		retval = image_calculate_checksum(text, text_size, &text_crc);
+		if (retval != ERROR_OK)
+			goto done;
 	}
-	struct imagesection *section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
-	if (!section) {
-		free(lpsz_line);
+
+	if (image_text_cache_enabled && image_text_cache.buffer && image_text_cache.type == image->type &&
+			image_text_cache.text_size == text_size && image_text_cache.text_crc == text_crc &&
+			!memcmp(image_text_cache.text, text, text_size)) {
+		LOG_DEBUG("using cached parse of %zu byte image", text_size);
+		retval = image_text_copy(buffer, &image->sections,
+				image_text_cache.buffer, image_text_cache.sections,
+				image_text_cache.buffer_size, image_text_cache.num_sections);
+		if (retval != ERROR_OK)
+			goto done;
+		image->num_sections = image_text_cache.num_sections;
+		image->start_address_set = image_text_cache.start_address_set;
+		image->start_address = image_text_cache.start_address;
+		goto done;
+	}
+
+	/* we can't determine the number of sections that we'll have to create ahead of time,
+	 * so we locally hold them until parsing is finished */
+	section = malloc(sizeof(struct imagesection) * IMAGE_MAX_SECTIONS);
+	*buffer = malloc(text_size / 2 + 1);
+	if (!section || !*buffer) {
 		LOG_ERROR("Out of memory");
-		return ERROR_FAIL;
+		retval = ERROR_FAIL;
+		goto done;
 	}
-	int retval;
 
-	retval = image_mot_buffer_complete_inner(image, lpsz_line, section);
+	if (image->type == IMAGE_IHEX)
+		retval = image_ihex_parse(image, (const char *)text, text_size, *buffer, section);
+	else
+		retval = image_mot_parse(image, (const char *)text, text_size, *buffer, section);
 
-	free(section);
-	free(lpsz_line);
+	if (retval == ERROR_OK) {
+		/* sections are laid out in file order, the last one ends the data */
+		size_t buffer_size = 0;
+		if (image->num_sections) {
+			struct imagesection *last = &section[image->num_sections - 1];
+			buffer_size = (uint8_t *)last->private - *buffer + last->size;
+		}
 
+		image->sections = malloc(sizeof(struct imagesection) * (image->num_sections ? image->num_sections : 1));
+		if (!image->sections) {
+			LOG_ERROR("Out of memory");
+			retval = ERROR_FAIL;
+		} else {
+			memcpy(image->sections, section, sizeof(struct imagesection) * image->num_sections);
+
+			/* replace the cached parse, a failure here only costs the next open */
+			uint8_t *cache_text = NULL;
+			uint8_t *cache_buffer;
+			struct imagesection *cache_sections;
+			image_free_cache();
+			if (image_text_cache_enabled && text_size <= IMAGE_TEXT_CACHE_MAX_SIZE)
+				cache_text = malloc(text_size ? text_size : 1);
+			if (cache_text && image_text_copy(&cache_buffer, &cache_sections, *buffer, section,
+					buffer_size, image->num_sections) != ERROR_OK) {
+				free(cache_text);
+				cache_text = NULL;
+			}
+			if (cache_text) {
+				memcpy(cache_text, text, text_size);
+				image_text_cache.type = image->type;
+				image_text_cache.text_size = text_size;
+				image_text_cache.text_crc = text_crc;
+				image_text_cache.text = cache_text;
+				image_text_cache.buffer = cache_buffer;
+				image_text_cache.buffer_size = buffer_size;
+				image_text_cache.num_sections = image->num_sections;
+				image_text_cache.sections = cache_sections;
+				image_text_cache.start_address_set = image->start_address_set;
+				image_text_cache.start_address = image->start_address;
+			}
+		}
+	}
+
+done:
+	if (retval != ERROR_OK) {
+		free(*buffer);
+		*buffer = NULL;
+	}
+	free(section);
+	free(text_copy);
 	return retval;
 }
 
@@ -990,11 +1090,11 @@ int image_open(struct image *image, const char *url, const char *type_string)
 
 		image_ihex = image->type_private = malloc(sizeof(struct image_ihex));
 
-		retval = fileio_open(&image_ihex->fileio, url, FILEIO_READ, FILEIO_TEXT);
+		retval = fileio_open(&image_ihex->fileio, url, FILEIO_READ, FILEIO_BINARY);
 		if (retval != ERROR_OK)
 			return retval;
 
-		retval = image_ihex_buffer_complete(image);
+		retval = image_text_buffer_complete(image, image_ihex->fileio, &image_ihex->buffer);
 		if (retval != ERROR_OK) {
 			LOG_ERROR(
 				"failed buffering IHEX image, check server output for additional information");
@@ -1041,11 +1141,11 @@ int image_open(struct image *image, const char *url, const char *type_string)
 
 		image_mot = image->type_private = malloc(sizeof(struct image_mot));
 
-		retval = fileio_open(&image_mot->fileio, url, FILEIO_READ, FILEIO_TEXT);
+		retval = fileio_open(&image_mot->fileio, url, FILEIO_READ, FILEIO_BINARY);
 		if (retval != ERROR_OK)
 			return retval;
 
-		retval = image_mot_buffer_complete(image);
+		retval = image_text_buffer_complete(image, image_mot->fileio, &image_mot->buffer);
 		if (retval != ERROR_OK) {
 			LOG_ERROR(
 				"failed buffering S19 image, check server output for additional information");
@@ -1073,6 +1173,59 @@ int image_open(struct image *image, const char *url, const char *type_string)
 	return retval;
 };
 
+/**
+ * Get a read only pointer to @a size bytes of a section without copying
+ * them: binary and ELF images point into the file mapping, ihex, S-record
+ * and builder images into their section buffers. The data stays valid
+ * until image_close().
+ *
+ * @returns ERROR_IMAGE_NOT_MAPPED if the range is only reachable through
+ * image_read_section(), e.g. target memory, unmapped files or the zero
+ * filled tail of an ELF segment.
+ */
+int image_map_section(struct image *image, int section, target_addr_t offset,
+		uint32_t size, const uint8_t **data)
+{
+	if (offset + size > image->sections[section].size)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (image->type == IMAGE_BINARY) {
+		struct image_binary *image_binary = image->type_private;
+
+		if (section != 0)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+
+		if (fileio_map(image_binary->fileio, offset, size, data) != ERROR_OK)
+			return ERROR_IMAGE_NOT_MAPPED;
+	} else if (image->type == IMAGE_ELF) {
+		struct image_elf *elf = image->type_private;
+		uint64_t file_offset, file_size;
+
+		if (elf->is_64_bit) {
+			Elf64_Phdr *segment = image->sections[section].private;
+			file_offset = field64(elf, segment->p_offset);
+			file_size = field64(elf, segment->p_filesz);
+		} else {
+			Elf32_Phdr *segment = image->sections[section].private;
+			file_offset = field32(elf, segment->p_offset);
+			file_size = field32(elf, segment->p_filesz);
+		}
+
+		if (offset + size > file_size)
+			return ERROR_IMAGE_NOT_MAPPED;
+
+		if (fileio_map(elf->fileio, file_offset + offset, size, data) != ERROR_OK)
+			return ERROR_IMAGE_NOT_MAPPED;
+	} else if (image->type == IMAGE_IHEX || image->type == IMAGE_SRECORD
+			|| image->type == IMAGE_BUILDER) {
+		*data = (uint8_t *)image->sections[section].private + offset;
+	} else {
+		return ERROR_IMAGE_NOT_MAPPED;
+	}
+
+	return ERROR_OK;
+}
+
 int image_read_section(struct image *image,
 	int section,
 	target_addr_t offset,
@@ -1099,6 +1252,13 @@ int image_read_section(struct image *image,
 		if (section != 0)
 			return ERROR_COMMAND_SYNTAX_ERROR;
 
+		const uint8_t *data;
+		if (fileio_map(image_binary->fileio, offset, size, &data) == ERROR_OK) {
+			memcpy(buffer, data, size);
+			*size_read = size;
+			return ERROR_OK;
+		}
+
 		/* seek to offset */
 		retval = fileio_seek(image_binary->fileio, offset);
 		if (retval != ERROR_OK)
@@ -1267,7 +1427,10 @@ int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *c
 	uint32_t crc = 0xffffffff;
 	LOG_DEBUG("Calculating checksum");
 
-	static uint32_t crc32_table[256];
+	/* crc32_table[0] is the classic bytewise table, crc32_table[k] advances
+	 * an entry of crc32_table[k - 1] by one more zero byte.  This lets the
+	 * main loop consume eight bytes per iteration (slice-by-8). */
+	static uint32_t crc32_table[8][256];
 
 	static bool first_init;
 	if (!first_init) {
@@ -1277,8 +1440,12 @@ int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *c
 			/* as per gdb */
 			for (c = i << 24, j = 8; j > 0; --j)
 				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
-			crc32_table[i] = c;
+			crc32_table[0][i] = c;
 		}
+		for (i = 0; i < 256; i++)
+			for (j = 1; j < 8; j++)
+				crc32_table[j][i] = (crc32_table[j - 1][i] << 8) ^
+					crc32_table[0][crc32_table[j - 1][i] >> 24];
 
 		first_init = true;
 	}
@@ -1288,9 +1455,22 @@ int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *c
 		if (run > 32768)
 			run = 32768;
 		nbytes -= run;
+		while (run >= 8) {
+			crc ^= be_to_h_u32(buffer);
+			crc = crc32_table[7][crc >> 24] ^
+				crc32_table[6][(crc >> 16) & 255] ^
+				crc32_table[5][(crc >> 8) & 255] ^
+				crc32_table[4][crc & 255] ^
+				crc32_table[3][buffer[4]] ^
+				crc32_table[2][buffer[5]] ^
+				crc32_table[1][buffer[6]] ^
+				crc32_table[0][buffer[7]];
+			buffer += 8;
+			run -= 8;
+		}
 		while (run--) {
 			/* as per gdb */
-			crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buffer++) & 255];
+			crc = (crc << 8) ^ crc32_table[0][((crc >> 24) ^ *buffer++) & 255];
 		}
 		keep_alive();
 	}
@@ -105,7 +105,12 @@ struct image_mot {
 int image_open(struct image *image, const char *url, const char *type_string);
 int image_read_section(struct image *image, int section, target_addr_t offset,
 		uint32_t size, uint8_t *buffer, size_t *size_read);
+int image_map_section(struct image *image, int section, target_addr_t offset,
+		uint32_t size, const uint8_t **data);
 void image_close(struct image *image);
+void image_free_cache(void);
+bool image_get_cache_enabled(void);
+void image_set_cache_enabled(bool enable);
 
 int image_add_section(struct image *image, target_addr_t base, uint32_t size,
 		uint64_t flags, uint8_t const *data);
@@ -117,5 +122,6 @@ int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes,
 #define ERROR_IMAGE_TYPE_UNKNOWN	(-1401)
 #define ERROR_IMAGE_TEMPORARILY_UNAVAILABLE		(-1402)
 #define ERROR_IMAGE_CHECKSUM		(-1403)
+#define ERROR_IMAGE_NOT_MAPPED		(-1404)
 
 #endif /* OPENOCD_TARGET_IMAGE_H */
@@ -21,6 +21,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <helper/log.h>
 #include <helper/binarybuffer.h>
 #include <helper/command.h>
@@ -28,6 +29,37 @@
 
 #include "target.h"
 
+/* Maximum number of bytes read from a single up-channel per poll. */
+#define RTT_UP_CHANNEL_MAX_READ	0x10000
+
+/*
+ * Reads of up-channel buffers which are at most this number of bytes apart
+ * are merged into a single memory access.
+ */
+#define RTT_READ_MERGE_GAP	64
+
+/* Contiguous part of an up-channel buffer to be read. */
+struct rtt_read_segment {
+	/** Address on the target. */
+	target_addr_t address;
+	/** Length in bytes. */
+	uint32_t length;
+	/** Destination in host memory. */
+	uint8_t *data;
+};
+
+static void parse_rtt_channel(const uint8_t *buf, target_addr_t address,
+		struct rtt_channel *channel)
+{
+	channel->address = address;
+	channel->name_addr = buf_get_u32(buf + 0, 0, 32);
+	channel->buffer_addr = buf_get_u32(buf + 4, 0, 32);
+	channel->size = buf_get_u32(buf + 8, 0, 32);
+	channel->write_pos = buf_get_u32(buf + 12, 0, 32);
+	channel->read_pos = buf_get_u32(buf + 16, 0, 32);
+	channel->flags = buf_get_u32(buf + 20, 0, 32);
+}
+
 static int read_rtt_channel(struct target *target,
 		const struct rtt_control *ctrl, unsigned int channel_index,
 		enum rtt_channel_type type, struct rtt_channel *channel)
@@ -46,17 +78,43 @@ static int read_rtt_channel(struct target *target,
 	if (ret != ERROR_OK)
 		return ret;
 
-	channel->address = address;
-	channel->name_addr = buf_get_u32(buf + 0, 0, 32);
-	channel->buffer_addr = buf_get_u32(buf + 4, 0, 32);
-	channel->size = buf_get_u32(buf + 8, 0, 32);
-	channel->write_pos = buf_get_u32(buf + 12, 0, 32);
-	channel->read_pos = buf_get_u32(buf + 16, 0, 32);
-	channel->flags = buf_get_u32(buf + 20, 0, 32);
+	parse_rtt_channel(buf, address, channel);
 
 	return ERROR_OK;
 }
 
+/*
+ * Read the descriptors of the first num_channels up-channels with a single
+ * memory access.
+ */
+static int read_rtt_up_channels(struct target *target,
+		const struct rtt_control *ctrl, size_t num_channels,
+		struct rtt_channel *channels)
+{
+	int ret;
+	uint8_t *buf;
+	target_addr_t address;
+
+	buf = malloc(num_channels * RTT_CHANNEL_SIZE);
+
+	if (!buf)
+		return ERROR_FAIL;
+
+	address = ctrl->address + RTT_CB_SIZE;
+	ret = target_read_buffer(target, address,
+		num_channels * RTT_CHANNEL_SIZE, buf);
+
+	if (ret == ERROR_OK) {
+		for (size_t i = 0; i < num_channels; i++)
+			parse_rtt_channel(buf + i * RTT_CHANNEL_SIZE,
+				address + i * RTT_CHANNEL_SIZE, &channels[i]);
+	}
+
+	free(buf);
+
+	return ret;
+}
+
 int target_rtt_start(struct target *target, const struct rtt_control *ctrl,
 		void *user_data)
 {
@@ -326,103 +384,243 @@ int target_rtt_read_channel_info(struct target *target,
 	return ERROR_OK;
 }
 
-static int read_from_channel(struct target *target,
-		const struct rtt_channel *channel, uint8_t *buffer,
-		size_t *length)
+/* Get the number of bytes to be read from an up-channel in this poll. */
+static uint32_t channel_read_length(const struct rtt_channel *channel)
 {
-	int ret;
 	uint32_t len;
 
-	if (!*length)
-		return ERROR_OK;
+	if (channel->read_pos <= channel->write_pos)
+		len = channel->write_pos - channel->read_pos;
+	else
+		len = channel->size - channel->read_pos + channel->write_pos;
 
-	if (channel->read_pos == channel->write_pos) {
-		len = 0;
-	} else if (channel->read_pos < channel->write_pos) {
-		len = MIN(*length, channel->write_pos - channel->read_pos);
+	return MIN(len, RTT_UP_CHANNEL_MAX_READ);
+}
 
-		ret = target_read_buffer(target,
-			channel->buffer_addr + channel->read_pos, len, buffer);
+/* Describe the (at most two) buffer parts which hold len bytes of data. */
+static void add_channel_segments(const struct rtt_channel *channel,
+		uint32_t len, uint8_t *buffer, struct rtt_read_segment *segments,
+		size_t *num_segments)
+{
+	uint32_t first_length;
 
-		if (ret != ERROR_OK)
-			return ret;
-	} else {
-		uint32_t first_length;
+	first_length = MIN(len, channel->size - channel->read_pos);
 
-		len = MIN(*length,
-			channel->size - channel->read_pos + channel->write_pos);
-		first_length = MIN(len, channel->size - channel->read_pos);
+	segments[*num_segments].address = channel->buffer_addr +
+		channel->read_pos;
+	segments[*num_segments].length = first_length;
+	segments[*num_segments].data = buffer;
+	(*num_segments)++;
 
-		ret = target_read_buffer(target,
-			channel->buffer_addr + channel->read_pos, first_length, buffer);
+	if (len > first_length) {
+		segments[*num_segments].address = channel->buffer_addr;
+		segments[*num_segments].length = len - first_length;
+		segments[*num_segments].data = buffer + first_length;
+		(*num_segments)++;
+	}
+}
 
-		if (ret != ERROR_OK)
-			return ret;
+static int compare_read_segments(const void *a, const void *b)
+{
+	const struct rtt_read_segment *sa = a;
+	const struct rtt_read_segment *sb = b;
 
-		ret = target_read_buffer(target, channel->buffer_addr,
-			len - first_length, buffer + first_length);
+	if (sa->address < sb->address)
+		return -1;
 
-		if (ret != ERROR_OK)
-			return ret;
-	}
+	if (sa->address > sb->address)
+		return 1;
 
-	if (len > 0) {
-		ret = target_write_u32(target, channel->address + 16,
-			(channel->read_pos + len) % channel->size);
+	return 0;
+}
 
-		if (ret != ERROR_OK)
+/*
+ * Read all segments, merging segments which are located close to each other
+ * into a single memory access. This is typically the case for the buffers of
+ * the up-channels, which are allocated next to each other by the target.
+ */
+static int read_segments(struct target *target,
+		struct rtt_read_segment *segments, size_t num_segments)
+{
+	size_t i = 0;
+
+	qsort(segments, num_segments, sizeof(*segments), compare_read_segments);
+
+	while (i < num_segments) {
+		int ret;
+		size_t j;
+		uint8_t *buf;
+		target_addr_t start = segments[i].address;
+		target_addr_t end = start + segments[i].length;
+
+		for (j = i + 1; j < num_segments; j++) {
+			if (segments[j].address > end + RTT_READ_MERGE_GAP)
+				break;
+
+			end = MAX(end, segments[j].address + segments[j].length);
+		}
+
+		if (j == i + 1) {
+			ret = target_read_buffer(target, start, segments[i].length,
+				segments[i].data);
+
+			if (ret != ERROR_OK)
+				return ret;
+
+			i = j;
+			continue;
+		}
+
+		buf = malloc(end - start);
+
+		if (!buf)
+			return ERROR_FAIL;
+
+		ret = target_read_buffer(target, start, end - start, buf);
+
+		if (ret != ERROR_OK) {
+			free(buf);
 			return ret;
-	}
+		}
 
-	*length = len;
+		for (; i < j; i++)
+			memcpy(segments[i].data, buf + (segments[i].address - start),
+				segments[i].length);
+
+		free(buf);
+	}
 
 	return ERROR_OK;
 }
 
 int target_rtt_read_callback(struct target *target,
 		const struct rtt_control *ctrl, struct rtt_sink_list **sinks,
-		size_t num_channels, void *user_data)
+		size_t num_channels, size_t *length, void *user_data)
 {
+	int ret;
+	struct rtt_channel *channels;
+	struct rtt_read_segment *segments;
+	uint32_t *lengths;
+	uint8_t *buffer;
+	size_t num_segments;
+	size_t total_length;
+
+	*length = 0;
 	num_channels = MIN(num_channels, ctrl->num_up_channels);
 
+	/* Only the descriptors up to the last channel with a sink are needed. */
+	while (num_channels && !sinks[num_channels - 1])
+		num_channels--;
+
+	if (!num_channels)
+		return ERROR_OK;
+
+	channels = calloc(num_channels, sizeof(*channels));
+	segments = calloc(2 * num_channels, sizeof(*segments));
+	lengths = calloc(num_channels, sizeof(*lengths));
+
+	if (!channels || !segments || !lengths) {
+		ret = ERROR_FAIL;
+		goto out;
+	}
+
+	ret = read_rtt_up_channels(target, ctrl, num_channels, channels);
+
+	if (ret != ERROR_OK) {
+		LOG_ERROR("rtt: Failed to read up-channel descriptions");
+		goto out;
+	}
+
+	total_length = 0;
+
 	for (size_t i = 0; i < num_channels; i++) {
-		int ret;
-		struct rtt_channel channel;
-		uint8_t buffer[1024];
-		size_t length;
+		const struct rtt_channel *channel = &channels[i];
 
 		if (!sinks[i])
 			continue;
 
-		ret = read_rtt_channel(target, ctrl, i, RTT_CHANNEL_TYPE_UP,
-			&channel);
-
-		if (ret != ERROR_OK) {
-			LOG_ERROR("rtt: Failed to read up-channel %zu description", i);
-			return ret;
-		}
-
-		if (!channel_is_active(&channel)) {
+		if (!channel_is_active(channel)) {
 			LOG_WARNING("rtt: Up-channel %zu is not active", i);
 			continue;
 		}
 
-		if (channel.size < RTT_CHANNEL_BUFFER_MIN_SIZE) {
+		if (channel->size < RTT_CHANNEL_BUFFER_MIN_SIZE) {
 			LOG_WARNING("rtt: Up-channel %zu is not large enough", i);
 			continue;
 		}
 
-		length = sizeof(buffer);
-		ret = read_from_channel(target, &channel, buffer, &length);
+		if (channel->read_pos >= channel->size
+				|| channel->write_pos >= channel->size) {
+			LOG_WARNING("rtt: Up-channel %zu has invalid buffer positions",
+				i);
+			continue;
+		}
+
+		lengths[i] = channel_read_length(channel);
+		total_length += lengths[i];
+	}
+
+	if (!total_length)
+		goto out;
+
+	buffer = malloc(total_length);
+
+	if (!buffer) {
+		ret = ERROR_FAIL;
+		goto out;
+	}
+
+	num_segments = 0;
+	total_length = 0;
+
+	for (size_t i = 0; i < num_channels; i++) {
+		if (!lengths[i])
+			continue;
+
+		add_channel_segments(&channels[i], lengths[i], buffer + total_length,
+			segments, &num_segments);
+		total_length += lengths[i];
+	}
+
+	ret = read_segments(target, segments, num_segments);
+
+	if (ret != ERROR_OK) {
+		LOG_ERROR("rtt: Failed to read from up-channels");
+		free(buffer);
+		goto out;
+	}
+
+	total_length = 0;
+
+	for (size_t i = 0; i < num_channels; i++) {
+		const struct rtt_channel *channel = &channels[i];
+		const uint8_t *data = buffer + total_length;
+
+		if (!lengths[i])
+			continue;
+
+		total_length += lengths[i];
+
+		ret = target_write_u32(target, channel->address + 16,
+			(channel->read_pos + lengths[i]) % channel->size);
 
 		if (ret != ERROR_OK) {
-			LOG_ERROR("rtt: Failed to read from up-channel %zu", i);
-			return ret;
+			LOG_ERROR("rtt: Failed to update up-channel %zu", i);
+			free(buffer);
+			goto out;
 		}
 
 		for (struct rtt_sink_list *sink = sinks[i]; sink; sink = sink->next)
-			sink->read(i, buffer, length, sink->user_data);
+			sink->read(i, data, lengths[i], sink->user_data);
 	}
 
-	return ERROR_OK;
+	free(buffer);
+	*length = total_length;
+
+out:
+	free(lengths);
+	free(segments);
+	free(channels);
+
+	return ret;
 }
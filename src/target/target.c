@@ -584,6 +584,148 @@ int target_poll(struct target *target)
 	return ERROR_OK;
 }
 
+/* Host side memory cache, see target_read_buffer(). Blocks are aligned to
+ * TARGET_MEM_CACHE_BLOCK_SIZE and clipped to the region they belong to. */
+#define TARGET_MEM_CACHE_BLOCK_SIZE		1024
+#define TARGET_MEM_CACHE_MAX_BLOCKS		256
+
+struct target_mem_cache_region {
+	target_addr_t address;
+	uint32_t size;
+	struct target_mem_cache_region *next;
+};
+
+struct target_mem_cache_block {
+	target_addr_t address;
+	uint32_t size;
+	uint8_t *data;
+	struct target_mem_cache_block *next;
+};
+
+static void target_mem_cache_flush(struct target *target)
+{
+	struct target_mem_cache_block *block = target->mem_cache_blocks;
+
+	while (block) {
+		struct target_mem_cache_block *next = block->next;
+		free(block->data);
+		free(block);
+		block = next;
+	}
+
+	target->mem_cache_blocks = NULL;
+	target->mem_cache_num_blocks = 0;
+}
+
+/* Memory may be shared between targets (SMP, multi-core parts), so any
+ * write, algorithm run, resume or step drops the cache of every target. */
+static void target_mem_cache_flush_all(void)
+{
+	for (struct target *target = all_targets; target; target = target->next)
+		target_mem_cache_flush(target);
+}
+
+static void target_mem_cache_free_regions(struct target *target)
+{
+	struct target_mem_cache_region *region = target->mem_cache_regions;
+
+	while (region) {
+		struct target_mem_cache_region *next = region->next;
+		free(region);
+		region = next;
+	}
+
+	target->mem_cache_regions = NULL;
+}
+
+static struct target_mem_cache_region *target_mem_cache_find_region(struct target *target,
+		target_addr_t address, uint32_t size)
+{
+	for (struct target_mem_cache_region *region = target->mem_cache_regions;
+			region; region = region->next) {
+		if (size <= region->size && address >= region->address &&
+				address - region->address <= region->size - size)
+			return region;
+	}
+
+	return NULL;
+}
+
+static struct target_mem_cache_block *target_mem_cache_get_block(struct target *target,
+		struct target_mem_cache_region *region, target_addr_t address)
+{
+	struct target_mem_cache_block *block;
+
+	for (block = target->mem_cache_blocks; block; block = block->next) {
+		if (address >= block->address && address - block->address < block->size)
+			return block;
+	}
+
+	target_addr_t aligned = address & ~(target_addr_t)(TARGET_MEM_CACHE_BLOCK_SIZE - 1);
+	target_addr_t start = MAX(aligned, region->address);
+	uint32_t size = MIN(TARGET_MEM_CACHE_BLOCK_SIZE - (uint32_t)(start - aligned),
+			region->size - (uint32_t)(start - region->address));
+
+	if (target->mem_cache_num_blocks >= TARGET_MEM_CACHE_MAX_BLOCKS)
+		target_mem_cache_flush(target);
+
+	block = malloc(sizeof(*block));
+	if (!block)
+		return NULL;
+	block->data = malloc(size);
+	if (!block->data) {
+		free(block);
+		return NULL;
+	}
+
+	if (target->type->read_buffer(target, start, size, block->data) != ERROR_OK) {
+		free(block->data);
+		free(block);
+		return NULL;
+	}
+
+	block->address = start;
+	block->size = size;
+	block->next = target->mem_cache_blocks;
+	target->mem_cache_blocks = block;
+	target->mem_cache_num_blocks++;
+
+	return block;
+}
+
+/* Try to serve a read from the cache, filling missing blocks on the way.
+ * Returns false if the range is not cacheable or a block could not be read,
+ * in which case the caller reads the target directly. */
+static bool target_mem_cache_read(struct target *target, target_addr_t address,
+		uint32_t size, uint8_t *buffer)
+{
+	if (!target->mem_cache_enabled || target->state != TARGET_HALTED)
+		return false;
+
+	/* large dumps would only thrash the cache */
+	if (size > TARGET_MEM_CACHE_BLOCK_SIZE * TARGET_MEM_CACHE_MAX_BLOCKS / 2)
+		return false;
+
+	struct target_mem_cache_region *region = target_mem_cache_find_region(target, address, size);
+	if (!region)
+		return false;
+
+	while (size > 0) {
+		struct target_mem_cache_block *block = target_mem_cache_get_block(target, region, address);
+		if (!block)
+			return false;
+
+		uint32_t offset = address - block->address;
+		uint32_t chunk = MIN(size, block->size - offset);
+		memcpy(buffer, block->data + offset, chunk);
+		address += chunk;
+		buffer += chunk;
+		size -= chunk;
+	}
+
+	return true;
+}
+
 int target_halt(struct target *target)
 {
 	int retval;
@@ -646,6 +788,8 @@ int target_resume(struct target *target, int current, target_addr_t address,
 
 	target_call_event_callbacks(target, TARGET_EVENT_RESUME_START);
 
+	target_mem_cache_flush_all();
+
 	/* note that resume *must* be asynchronous. The CPU can halt before
 	 * we poll. The CPU can even halt at the current PC as a result of
 	 * a software breakpoint being inserted by (a bug?) the application.
@@ -865,6 +1009,8 @@ int target_run_algorithm(struct target *target,
 		goto done;
 	}
 
+	target_mem_cache_flush_all();
+
 	target->running_alg = true;
 	retval = target->type->run_algorithm(target,
 			num_mem_params, mem_params,
@@ -910,6 +1056,8 @@ int target_start_algorithm(struct target *target,
 		goto done;
 	}
 
+	target_mem_cache_flush_all();
+
 	target->running_alg = true;
 	retval = target->type->start_algorithm(target,
 			num_mem_params, mem_params,
@@ -1346,6 +1494,7 @@ int target_write_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	target_mem_cache_flush_all();
 	return target->type->write_memory(target, address, size, count, buffer);
 }
 
@@ -1360,6 +1509,7 @@ int target_write_phys_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_phys_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	target_mem_cache_flush_all();
 	return target->type->write_phys_memory(target, address, size, count, buffer);
 }
 
@@ -1487,6 +1637,8 @@ int target_step(struct target *target,
 
 	target_call_event_callbacks(target, TARGET_EVENT_STEP_START);
 
+	target_mem_cache_flush_all();
+
 	retval = target->type->step(target, current, address, handle_breakpoints);
 	if (retval != ERROR_OK)
 		return retval;
@@ -1544,6 +1696,45 @@ static int target_profiling(struct target *target, uint32_t *samples,
 			num_samples, seconds);
 }
 
+/* Samples per call of profiling() when a target cannot stream */
+#define PROFILE_BATCH_SAMPLES	10000
+
+static int target_profiling_stream(struct target *target,
+		int (*callback)(struct target *target, const uint32_t *samples,
+			uint32_t num_samples, void *priv),
+		void *priv, uint32_t seconds)
+{
+	int retval;
+
+	if (target->type->profiling_stream) {
+		retval = target->type->profiling_stream(target, callback, priv, seconds);
+		if (retval != ERROR_NOT_IMPLEMENTED)
+			return retval;
+	}
+
+	uint32_t *samples = malloc(sizeof(uint32_t) * PROFILE_BATCH_SAMPLES);
+	if (!samples) {
+		LOG_ERROR("No memory to store samples.");
+		return ERROR_FAIL;
+	}
+
+	int64_t end_ms = timeval_ms() + seconds * 1000LL;
+	int64_t now_ms;
+	do {
+		uint32_t num_samples;
+		now_ms = timeval_ms();
+		uint32_t remaining = DIV_ROUND_UP(MAX(end_ms - now_ms, 1), 1000);
+		retval = target_profiling(target, samples, PROFILE_BATCH_SAMPLES,
+				&num_samples, remaining);
+		if (retval == ERROR_OK)
+			retval = callback(target, samples, num_samples, priv);
+		now_ms = timeval_ms();
+	} while (retval == ERROR_OK && now_ms < end_ms);
+
+	free(samples);
+	return retval;
+}
+
 static int handle_target(void *priv);
 
 static int target_init_one(struct command_context *cmd_ctx,
@@ -1825,6 +2016,10 @@ int target_unregister_timer_callback(int (*callback)(void *priv), void *priv)
 
 	for (struct target_timer_callback *c = target_timer_callbacks;
 	     c; c = c->next) {
+		/* an entry removed earlier is only freed once the callbacks run,
+		 * skip it so a callback registered again in the meantime is found */
+		if (c->removed)
+			continue;
 		if ((c->callback == callback) && (c->priv == priv)) {
 			c->removed = true;
 			return ERROR_OK;
@@ -1848,6 +2043,9 @@ int target_call_event_callbacks(struct target *target, enum target_event event)
 			target_event_name(event),
 			target_name(target));
 
+	/* whatever the event, memory may have changed behind our back */
+	target_mem_cache_flush(target);
+
 	target_handle_event(target, event);
 
 	while (callback) {
@@ -2272,6 +2470,9 @@ static void target_destroy(struct target *target)
 
 	target_free_all_working_areas(target);
 
+	target_mem_cache_flush(target);
+	target_mem_cache_free_regions(target);
+
 	/* release the targets SMP list */
 	if (target->smp) {
 		struct target_list *head, *tmp;
@@ -2429,6 +2630,8 @@ int target_write_buffer(struct target *target, target_addr_t address, uint32_t s
 		return ERROR_FAIL;
 	}
 
+	target_mem_cache_flush_all();
+
 	return target->type->write_buffer(target, address, size, buffer);
 }
 
@@ -2494,6 +2697,9 @@ int target_read_buffer(struct target *target, target_addr_t address, uint32_t si
 		return ERROR_FAIL;
 	}
 
+	if (target_mem_cache_read(target, address, size, buffer))
+		return ERROR_OK;
+
 	return target->type->read_buffer(target, address, size, buffer);
 }
 
@@ -3659,8 +3865,38 @@ static COMMAND_HELPER(parse_load_image_command, struct image *image,
 	return ERROR_OK;
 }
 
+/* Get the contents of a whole image section, as a pointer into the image
+ * when it can be mapped, else read into *buffer which the caller frees */
+static int target_image_section_data(struct image *image, unsigned int section,
+		const uint8_t **data, uint8_t **buffer, size_t *size)
+{
+	int retval;
+
+	*buffer = NULL;
+	*size = image->sections[section].size;
+	if (image_map_section(image, section, 0x0, *size, data) == ERROR_OK)
+		return ERROR_OK;
+
+	*buffer = malloc(*size);
+	if (!*buffer) {
+		LOG_ERROR("error allocating buffer for section (%zu bytes)", *size);
+		return ERROR_FAIL;
+	}
+
+	retval = image_read_section(image, section, 0x0, *size, *buffer, size);
+	if (retval != ERROR_OK) {
+		free(*buffer);
+		*buffer = NULL;
+		return retval;
+	}
+
+	*data = *buffer;
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_load_image_command)
 {
+	const uint8_t *data;
 	uint8_t *buffer;
 	size_t buf_cnt;
 	uint32_t image_size;
@@ -3684,20 +3920,9 @@ COMMAND_HANDLER(handle_load_image_command)
 	image_size = 0x0;
 	retval = ERROR_OK;
 	for (unsigned int i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
-		if (!buffer) {
-			command_print(CMD,
-						  "error allocating buffer for section (%d bytes)",
-						  (int)(image.sections[i].size));
-			retval = ERROR_FAIL;
-			break;
-		}
-
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
-		if (retval != ERROR_OK) {
-			free(buffer);
+		retval = target_image_section_data(&image, i, &data, &buffer, &buf_cnt);
+		if (retval != ERROR_OK)
 			break;
-		}
 
 		uint32_t offset = 0;
 		uint32_t length = buf_cnt;
@@ -3717,7 +3942,7 @@ COMMAND_HANDLER(handle_load_image_command)
 				length -= (image.sections[i].base_address + buf_cnt)-max_address;
 
 			retval = target_write_buffer(target,
-					image.sections[i].base_address + offset, length, buffer + offset);
+					image.sections[i].base_address + offset, length, data + offset);
 			if (retval != ERROR_OK) {
 				free(buffer);
 				break;
@@ -3813,6 +4038,7 @@ enum verify_mode {
 
 static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode verify)
 {
+	const uint8_t *image_data;
 	uint8_t *buffer;
 	size_t buf_cnt;
 	uint32_t image_size;
@@ -3855,22 +4081,13 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 	int diffs = 0;
 	retval = ERROR_OK;
 	for (unsigned int i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
-		if (!buffer) {
-			command_print(CMD,
-					"error allocating buffer for section (%" PRIu32 " bytes)",
-					image.sections[i].size);
-			break;
-		}
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
-		if (retval != ERROR_OK) {
-			free(buffer);
+		retval = target_image_section_data(&image, i, &image_data, &buffer, &buf_cnt);
+		if (retval != ERROR_OK)
 			break;
-		}
 
 		if (verify >= IMAGE_VERIFY) {
 			/* calculate checksum of image */
-			retval = image_calculate_checksum(buffer, buf_cnt, &checksum);
+			retval = image_calculate_checksum(image_data, buf_cnt, &checksum);
 			if (retval != ERROR_OK) {
 				free(buffer);
 				break;
@@ -3900,13 +4117,13 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 				if (retval == ERROR_OK) {
 					uint32_t t;
 					for (t = 0; t < buf_cnt; t++) {
-						if (data[t] != buffer[t]) {
+						if (data[t] != image_data[t]) {
 							command_print(CMD,
 										  "diff %d address 0x%08x. Was 0x%02x instead of 0x%02x",
 										  diffs,
 										  (unsigned)(t + image.sections[i].base_address),
 										  data[t],
-										  buffer[t]);
+										  image_data[t]);
 							if (diffs++ >= 127) {
 								command_print(CMD, "More than 128 errors, the rest are not printed.");
 								free(data);
@@ -4219,8 +4436,84 @@ static void write_string(FILE *f, char *s)
 
 typedef unsigned char UNIT[2];  /* unit of profiling */
 
+/* Host side PC histogram, an open addressing hash table keyed by PC.
+ * Slots with a zero count are free. */
+struct profile_histogram {
+	uint32_t *pc;
+	uint32_t *count;
+	uint32_t size;			/* number of slots, a power of two */
+	uint32_t used;
+	uint64_t num_samples;
+};
+
+static uint32_t profile_histogram_slot(const struct profile_histogram *hist, uint32_t pc)
+{
+	uint32_t slot = ((pc >> 1) * 0x9E3779B1u) & (hist->size - 1);
+
+	while (hist->count[slot] && hist->pc[slot] != pc)
+		slot = (slot + 1) & (hist->size - 1);
+	return slot;
+}
+
+static int profile_histogram_resize(struct profile_histogram *hist, uint32_t size)
+{
+	struct profile_histogram old = *hist;
+
+	hist->pc = malloc(sizeof(uint32_t) * size);
+	hist->count = calloc(size, sizeof(uint32_t));
+	if (!hist->pc || !hist->count) {
+		free(hist->pc);
+		free(hist->count);
+		*hist = old;
+		LOG_ERROR("No memory to store samples.");
+		return ERROR_FAIL;
+	}
+	hist->size = size;
+
+	for (uint32_t i = 0; i < old.size; i++) {
+		if (!old.count[i])
+			continue;
+		uint32_t slot = profile_histogram_slot(hist, old.pc[i]);
+		hist->pc[slot] = old.pc[i];
+		hist->count[slot] = old.count[i];
+	}
+	free(old.pc);
+	free(old.count);
+	return ERROR_OK;
+}
+
+static int profile_histogram_add(struct profile_histogram *hist,
+		const uint32_t *samples, uint32_t num_samples)
+{
+	for (uint32_t i = 0; i < num_samples; i++) {
+		/* keep the load factor at or below one half */
+		if (hist->used * 2 >= hist->size) {
+			int retval = profile_histogram_resize(hist, hist->size ? hist->size * 2 : 4096);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+
+		uint32_t slot = profile_histogram_slot(hist, samples[i]);
+		if (!hist->count[slot]) {
+			hist->pc[slot] = samples[i];
+			hist->used++;
+		}
+		if (hist->count[slot] != UINT32_MAX)
+			hist->count[slot]++;
+	}
+	hist->num_samples += num_samples;
+	return ERROR_OK;
+}
+
+static void profile_histogram_free(struct profile_histogram *hist)
+{
+	free(hist->pc);
+	free(hist->count);
+	memset(hist, 0, sizeof(*hist));
+}
+
 /* Dump a gmon.out histogram file. */
-static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filename, bool with_range,
+static void write_gmon(const struct profile_histogram *hist, const char *filename, bool with_range,
 			uint32_t start_address, uint32_t end_address, struct target *target, uint32_t duration_ms)
 {
 	uint32_t i;
@@ -4243,18 +4536,24 @@ static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filen
 		min = start_address;
 		max = end_address;
 	} else {
-		min = samples[0];
-		max = samples[0];
-		for (i = 0; i < sample_num; i++) {
-			if (min > samples[i])
-				min = samples[i];
-			if (max < samples[i])
-				max = samples[i];
+		min = UINT32_MAX;
+		max = 0;
+		for (i = 0; i < hist->size; i++) {
+			if (!hist->count[i])
+				continue;
+			if (min > hist->pc[i])
+				min = hist->pc[i];
+			if (max < hist->pc[i])
+				max = hist->pc[i];
 		}
+		if (min > max)
+			min = max = 0;
 
 		/* max should be (largest sample + 1)
 		 * Refer to binutils/gprof/hist.c (find_histogram_for_pc) */
 		max++;
+		if (max - min < 2)
+			max = min + 2;
 	}
 
 	int address_space = max - min;
@@ -4266,30 +4565,36 @@ static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filen
 	uint32_t num_buckets = address_space / sizeof(UNIT);
 	if (num_buckets > max_buckets)
 		num_buckets = max_buckets;
-	int *buckets = malloc(sizeof(int) * num_buckets);
+	uint64_t *buckets = calloc(num_buckets, sizeof(uint64_t));
 	if (!buckets) {
 		fclose(f);
 		return;
 	}
-	memset(buckets, 0, sizeof(int) * num_buckets);
-	for (i = 0; i < sample_num; i++) {
-		uint32_t address = samples[i];
+	uint64_t max_bucket = 0;
+	for (i = 0; i < hist->size; i++) {
+		uint32_t address = hist->pc[i];
 
-		if ((address < min) || (max <= address))
+		if (!hist->count[i] || (address < min) || (max <= address))
 			continue;
 
 		long long a = address - min;
 		long long b = num_buckets;
 		long long c = address_space;
 		int index_t = (a * b) / c; /* danger!!!! int32 overflows */
-		buckets[index_t]++;
+		buckets[index_t] += hist->count[i];
+		if (max_bucket < buckets[index_t])
+			max_bucket = buckets[index_t];
 	}
 
+	/* Buckets are 16 bit. Rather than saturating them on long runs, scale
+	 * all buckets down and the sample rate with them to keep the times right. */
+	uint64_t scale = DIV_ROUND_UP(MAX(max_bucket, 1), 65535);
+
 	/* append binary memory gmon.out &profile_hist_hdr ((char*)&profile_hist_hdr + sizeof(struct gmon_hist_hdr)) */
 	write_long(f, min, target);			/* low_pc */
 	write_long(f, max, target);			/* high_pc */
 	write_long(f, num_buckets, target);	/* # of buckets */
-	float sample_rate = sample_num / (duration_ms / 1000.0);
+	float sample_rate = hist->num_samples / (MAX(duration_ms, 1) / 1000.0) / scale;
 	write_long(f, sample_rate, target);
 	write_string(f, "seconds");
 	for (i = 0; i < (15-strlen("seconds")); i++)
@@ -4301,10 +4606,7 @@ static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filen
 	char *data = malloc(2 * num_buckets);
 	if (data) {
 		for (i = 0; i < num_buckets; i++) {
-			int val;
-			val = buckets[i];
-			if (val > 65535)
-				val = 65535;
+			uint64_t val = buckets[i] / scale;
 			data[i * 2] = val&0xff;
 			data[i * 2 + 1] = (val >> 8) & 0xff;
 		}
@@ -4317,48 +4619,137 @@ static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filen
 	fclose(f);
 }
 
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Dump the histogram in folded stack format, one "pc count" line per
+ * sampled address, ready for flame graph tools. */
+static void write_folded(const struct profile_histogram *hist, const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+	if (!f)
+		return;
+
+	uint32_t *pcs = malloc(sizeof(uint32_t) * MAX(hist->used, 1));
+	if (!pcs) {
+		fclose(f);
+		return;
+	}
+	uint32_t num_pcs = 0;
+	for (uint32_t i = 0; i < hist->size; i++)
+		if (hist->count[i])
+			pcs[num_pcs++] = hist->pc[i];
+	qsort(pcs, num_pcs, sizeof(uint32_t), compare_u32);
+
+	for (uint32_t i = 0; i < num_pcs; i++)
+		fprintf(f, "0x%08" PRIx32 " %" PRIu32 "\n", pcs[i],
+				hist->count[profile_histogram_slot(hist, pcs[i])]);
+
+	free(pcs);
+	fclose(f);
+}
+
+struct profile_state {
+	struct profile_histogram hist;
+	const char *gmon_filename;
+	const char *folded_filename;
+	bool with_range;
+	uint32_t start_address;
+	uint32_t end_address;
+	int64_t start_ms;
+	int64_t last_sample_ms;
+	uint32_t flush_interval_ms;
+	int64_t next_flush_ms;
+};
+
+static void profile_write(struct profile_state *state, struct target *target)
+{
+	uint32_t duration_ms = state->last_sample_ms - state->start_ms;
+
+	write_gmon(&state->hist, state->gmon_filename, state->with_range,
+			state->start_address, state->end_address, target, duration_ms);
+	if (state->folded_filename)
+		write_folded(&state->hist, state->folded_filename);
+}
+
+static int profile_samples_callback(struct target *target, const uint32_t *samples,
+		uint32_t num_samples, void *priv)
+{
+	struct profile_state *state = priv;
+
+	int retval = profile_histogram_add(&state->hist, samples, num_samples);
+	if (retval != ERROR_OK)
+		return retval;
+
+	state->last_sample_ms = timeval_ms();
+	if (state->flush_interval_ms && state->last_sample_ms >= state->next_flush_ms) {
+		profile_write(state, target);
+		state->next_flush_ms += state->flush_interval_ms;
+		LOG_DEBUG("profile: %" PRIu64 " samples, %" PRIu32 " addresses written",
+				state->hist.num_samples, state->hist.used);
+	}
+
+	keep_alive();
+	return ERROR_OK;
+}
+
 /* profiling samples the CPU PC as quickly as OpenOCD is able,
  * which will be used as a random sampling of PC */
 COMMAND_HANDLER(handle_profile_command)
 {
 	struct target *target = get_current_target(CMD_CTX);
+	struct profile_state state = { 0 };
+
+	while (CMD_ARGC >= 2 && CMD_ARGV[0][0] == '-') {
+		if (strcmp(CMD_ARGV[0], "-flush") == 0) {
+			uint32_t flush_seconds;
+			COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], flush_seconds);
+			state.flush_interval_ms = flush_seconds * 1000;
+		} else if (strcmp(CMD_ARGV[0], "-folded") == 0) {
+			state.folded_filename = CMD_ARGV[1];
+		} else {
+			return ERROR_COMMAND_SYNTAX_ERROR;
+		}
+		CMD_ARGC -= 2;
+		CMD_ARGV += 2;
+	}
 
 	if ((CMD_ARGC != 2) && (CMD_ARGC != 4))
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
-	const uint32_t MAX_PROFILE_SAMPLE_NUM = 10000;
 	uint32_t offset;
-	uint32_t num_of_samples;
 	int retval = ERROR_OK;
 	bool halted_before_profiling = target->state == TARGET_HALTED;
 
 	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], offset);
-
-	uint32_t *samples = malloc(sizeof(uint32_t) * MAX_PROFILE_SAMPLE_NUM);
-	if (!samples) {
-		LOG_ERROR("No memory to store samples.");
-		return ERROR_FAIL;
+	state.gmon_filename = CMD_ARGV[1];
+	if (CMD_ARGC == 4) {
+		state.with_range = true;
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[2], state.start_address);
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[3], state.end_address);
 	}
 
-	uint64_t timestart_ms = timeval_ms();
+	state.start_ms = timeval_ms();
+	state.next_flush_ms = state.start_ms + state.flush_interval_ms;
 	/**
 	 * Some cores let us sample the PC without the
 	 * annoying halt/resume step; for example, ARMv7 PCSR.
 	 * Provide a way to use that more efficient mechanism.
 	 */
-	retval = target_profiling(target, samples, MAX_PROFILE_SAMPLE_NUM,
-				&num_of_samples, offset);
+	retval = target_profiling_stream(target, profile_samples_callback, &state, offset);
 	if (retval != ERROR_OK) {
-		free(samples);
+		profile_histogram_free(&state.hist);
 		return retval;
 	}
-	uint32_t duration_ms = timeval_ms() - timestart_ms;
-
-	assert(num_of_samples <= MAX_PROFILE_SAMPLE_NUM);
 
 	retval = target_poll(target);
 	if (retval != ERROR_OK) {
-		free(samples);
+		profile_histogram_free(&state.hist);
 		return retval;
 	}
 
@@ -4367,7 +4758,7 @@ COMMAND_HANDLER(handle_profile_command)
 		 * for consistency. */
 		retval = target_halt(target);
 		if (retval != ERROR_OK) {
-			free(samples);
+			profile_histogram_free(&state.hist);
 			return retval;
 		}
 	} else if (target->state == TARGET_HALTED && !halted_before_profiling) {
@@ -4375,31 +4766,24 @@ COMMAND_HANDLER(handle_profile_command)
 		 * it, for consistency. */
 		retval = target_resume(target, 1, 0, 0, 0);
 		if (retval != ERROR_OK) {
-			free(samples);
+			profile_histogram_free(&state.hist);
 			return retval;
 		}
 	}
 
 	retval = target_poll(target);
 	if (retval != ERROR_OK) {
-		free(samples);
+		profile_histogram_free(&state.hist);
 		return retval;
 	}
 
-	uint32_t start_address = 0;
-	uint32_t end_address = 0;
-	bool with_range = false;
-	if (CMD_ARGC == 4) {
-		with_range = true;
-		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[2], start_address);
-		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[3], end_address);
-	}
-
-	write_gmon(samples, num_of_samples, CMD_ARGV[1],
-		   with_range, start_address, end_address, target, duration_ms);
-	command_print(CMD, "Wrote %s", CMD_ARGV[1]);
+	profile_write(&state, target);
+	command_print(CMD, "Wrote %s (%" PRIu64 " samples)", state.gmon_filename,
+			state.hist.num_samples);
+	if (state.folded_filename)
+		command_print(CMD, "Wrote %s", state.folded_filename);
 
-	free(samples);
+	profile_histogram_free(&state.hist);
 	return retval;
 }
 
@@ -5959,6 +6343,66 @@ static int jim_target_invoke_event(Jim_Interp *interp, int argc, Jim_Obj *const
 	return JIM_OK;
 }
 
+COMMAND_HANDLER(handle_target_mem_cache)
+{
+	struct target *target = get_current_target(CMD_CTX);
+
+	if (CMD_ARGC == 0) {
+		command_print(CMD, "memory cache %s, %u block(s) cached",
+				target->mem_cache_enabled ? "enabled" : "disabled",
+				target->mem_cache_num_blocks);
+		for (struct target_mem_cache_region *region = target->mem_cache_regions;
+				region; region = region->next)
+			command_print(CMD, "region " TARGET_ADDR_FMT " size 0x%08" PRIx32,
+					region->address, region->size);
+		return ERROR_OK;
+	}
+
+	if (strcmp(CMD_ARGV[0], "region") == 0) {
+		if (CMD_ARGC != 3)
+			return ERROR_COMMAND_SYNTAX_ERROR;
+
+		target_addr_t address;
+		uint32_t size;
+		COMMAND_PARSE_ADDRESS(CMD_ARGV[1], address);
+		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[2], size);
+		if (!size || address + size - 1 < address) {
+			command_print(CMD, "invalid region");
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+
+		struct target_mem_cache_region *region = malloc(sizeof(*region));
+		if (!region) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		region->address = address;
+		region->size = size;
+		region->next = target->mem_cache_regions;
+		target->mem_cache_regions = region;
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (strcmp(CMD_ARGV[0], "flush") == 0) {
+		target_mem_cache_flush(target);
+	} else if (strcmp(CMD_ARGV[0], "clear") == 0) {
+		target_mem_cache_flush(target);
+		target_mem_cache_free_regions(target);
+	} else {
+		bool enable;
+		COMMAND_PARSE_ENABLE(CMD_ARGV[0], enable);
+		if (enable && !target->mem_cache_regions)
+			LOG_WARNING("no memory cache region configured, nothing will be cached");
+		target_mem_cache_flush(target);
+		target->mem_cache_enabled = enable;
+	}
+
+	return ERROR_OK;
+}
+
 static const struct command_registration target_instance_command_handlers[] = {
 	{
 		.name = "configure",
@@ -6081,6 +6525,14 @@ static const struct command_registration target_instance_command_handlers[] = {
 		.help = "displays a table of events defined for this target",
 		.usage = "",
 	},
+	{
+		.name = "mem_cache",
+		.handler = handle_target_mem_cache,
+		.mode = COMMAND_ANY,
+		.help = "Configure the host side cache used for target memory "
+			"reads while the target is halted",
+		.usage = "['enable'|'disable'|'flush'|'clear'|'region' address size]",
+	},
 	{
 		.name = "curstate",
 		.mode = COMMAND_EXEC,
@@ -6721,6 +7173,18 @@ COMMAND_HANDLER(handle_target_reset_nag)
 			"performance");
 }
 
+COMMAND_HANDLER(handle_image_cache_command)
+{
+	bool enable = image_get_cache_enabled();
+
+	int retval = CALL_COMMAND_HANDLER(handle_command_parse_bool,
+			&enable, "Keep the last parsed ihex/S-record image");
+	if (retval == ERROR_OK)
+		image_set_cache_enabled(enable);
+
+	return retval;
+}
+
 COMMAND_HANDLER(handle_ps_command)
 {
 	struct target *target = get_current_target(CMD_CTX);
@@ -6954,7 +7418,7 @@ static const struct command_registration target_exec_command_handlers[] = {
 		.name = "profile",
 		.handler = handle_profile_command,
 		.mode = COMMAND_EXEC,
-		.usage = "seconds filename [start end]",
+		.usage = "['-flush' seconds] ['-folded' filename] seconds filename [start end]",
 		.help = "profiling samples the CPU PC",
 	},
 	/** @todo don't register virt2phys() unless target supports it */
@@ -7176,6 +7640,14 @@ static const struct command_registration target_exec_command_handlers[] = {
 				"enabled to improve performance.",
 		.usage = "['enable'|'disable']",
 	},
+	{
+		.name = "image_cache",
+		.handler = handle_image_cache_command,
+		.mode = COMMAND_ANY,
+		.help = "Keep the last parsed ihex/S-record image in memory, "
+				"so that reading the same file again skips parsing.",
+		.usage = "['enable'|'disable']",
+	},
 	{
 		.name = "ps",
 		.handler = handle_ps_command,
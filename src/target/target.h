@@ -219,6 +219,13 @@ struct target {
 
 	/* The semihosting information, extracted from the target. */
 	struct semihosting *semihosting;
+
+	/* Host side cache of target memory, used by target_read_buffer() while
+	 * the target is halted. Only the configured regions are cached. */
+	bool mem_cache_enabled;
+	struct target_mem_cache_region *mem_cache_regions;
+	struct target_mem_cache_block *mem_cache_blocks;
+	unsigned int mem_cache_num_blocks;
 };
 
 struct target_list {
@@ -291,6 +291,15 @@ struct target_type {
 	int (*profiling)(struct target *target, uint32_t *samples,
 			uint32_t max_num_samples, uint32_t *num_samples, uint32_t seconds);
 
+	/* sample the PC for 'seconds', handing every batch of samples to
+	 * 'callback' as it arrives; sampling stops early if the callback fails.
+	 * Optional, return ERROR_NOT_IMPLEMENTED to fall back to profiling().
+	 */
+	int (*profiling_stream)(struct target *target,
+			int (*callback)(struct target *target, const uint32_t *samples,
+				uint32_t num_samples, void *priv),
+			void *priv, uint32_t seconds);
+
 	/* Return the number of address bits this target supports. This will
 	 * typically be 32 for 32-bit targets, and 64 for 64-bit targets. If not
 	 * implemented, it's assumed to be 32. */